@@ -0,0 +1,57 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+/* Atomic pointer access, which util/threading.h only offers for long and
+ * bool. Sequentially consistent like the os_atomic_* functions
+ */
+
+#ifdef _MSC_VER
+#include <intrin.h>
+
+static inline void *atomic_ptr_load(void *volatile *ptr)
+{
+    return _InterlockedCompareExchangePointer(ptr, NULL, NULL);
+}
+
+static inline void *atomic_ptr_exchange(void *volatile *ptr, void *val)
+{
+    return _InterlockedExchangePointer(ptr, val);
+}
+
+static inline void atomic_ptr_set(void *volatile *ptr, void *val)
+{
+    _InterlockedExchangePointer(ptr, val);
+}
+#else
+static inline void *atomic_ptr_load(void *volatile *ptr)
+{
+    return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+static inline void *atomic_ptr_exchange(void *volatile *ptr, void *val)
+{
+    return __atomic_exchange_n(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_ptr_set(void *volatile *ptr, void *val)
+{
+    __atomic_store_n(ptr, val, __ATOMIC_SEQ_CST);
+}
+#endif
@@ -0,0 +1,111 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <string.h>
+#include <util/base.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CLIP_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define CLIP_NEON
+#endif
+
+#include "clip.h"
+#include "clip-builtin.generated.h"
+#include "plugin-macros.generated.h"
+
+bool clip_load_file(struct clip *c, const char *path, ma_format format)
+{
+    ma_decoder_config cfg = ma_decoder_config_init(format, 0, 0);
+    ma_uint64 frames;
+    void *data;
+
+    memset(c, 0, sizeof(*c));
+    if (ma_decode_file(path, &cfg, &frames, &data) != MA_SUCCESS) {
+        blog(LOG_ERROR, "Failed to open '%s'", path);
+        return false;
+    }
+
+    c->data = data;
+    c->format = format;
+    c->frames = frames;
+    c->channels = cfg.channels;
+    c->sample_rate = cfg.sampleRate;
+    c->owned = true;
+    blog(LOG_DEBUG, "'%s' is %i ms long", path, (int)clip_length_ms(c)); // macos won't use %llu so screw it
+    return true;
+}
+
+void clip_load_builtin(struct clip *c)
+{
+    c->data = clip_builtin_data;
+    c->format = ma_format_f32;
+    c->frames = CLIP_BUILTIN_FRAMES;
+    c->channels = CLIP_BUILTIN_CHANNELS;
+    c->sample_rate = CLIP_BUILTIN_SAMPLE_RATE;
+    c->owned = false;
+}
+
+void clip_free(struct clip *c)
+{
+    if (c->owned)
+        ma_free((void *)c->data, NULL);
+    memset(c, 0, sizeof(*c));
+}
+
+static void s16_to_f32(float *out, const int16_t *in, size_t count)
+{
+    const float scale = 1.0f / 32768.0f;
+    size_t i = 0;
+
+#if defined(CLIP_SSE2)
+    const __m128 vscale = _mm_set1_ps(scale);
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        /* Sign extend by moving each sample into the upper half and shifting back */
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), vscale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), vscale));
+    }
+#elif defined(CLIP_NEON)
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t v = vld1q_s16(in + i);
+        vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), scale));
+        vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), scale));
+    }
+#endif
+
+    for (; i < count; i++)
+        out[i] = (float)in[i] * scale;
+}
+
+void clip_read(const struct clip *c, uint64_t cursor, void *out, ma_format out_format, uint32_t frames)
+{
+    size_t offset = (size_t)cursor * c->channels;
+    size_t count = (size_t)frames * c->channels;
+
+    if (out_format == c->format) {
+        size_t sample_size = ma_get_bytes_per_sample(c->format);
+        memcpy(out, (const uint8_t *)c->data + offset * sample_size, count * sample_size);
+    } else if (c->format == ma_format_s16 && out_format == ma_format_f32) {
+        s16_to_f32(out, (const int16_t *)c->data + offset, count);
+    }
+}
@@ -0,0 +1,61 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <miniaudio.h>
+
+/* A notification sound decoded to interleaved samples, ready to be copied
+ * into the device's buffer. Stored as f32 or, to halve the memory, as s16
+ * which is converted while playing unless the device takes s16 natively
+ */
+struct clip {
+    const void *data;
+    ma_format format;
+    uint64_t frames;
+    uint32_t channels;
+    uint32_t sample_rate;
+    bool owned;
+};
+
+/* Decodes the whole file at its own channel count and sample rate, format is
+ * either ma_format_f32 or ma_format_s16
+ */
+bool clip_load_file(struct clip *c, const char *path, ma_format format);
+
+/* The default sound, embedded at build time so it needs no file access */
+void clip_load_builtin(struct clip *c);
+
+void clip_free(struct clip *c);
+
+/* Copies frames starting at cursor into out, converting to out_format which
+ * has to be either ma_format_f32 or the clip's own format
+ */
+void clip_read(const struct clip *c, uint64_t cursor, void *out, ma_format out_format, uint32_t frames);
+
+static inline size_t clip_size(const struct clip *c)
+{
+    return (size_t)c->frames * c->channels * ma_get_bytes_per_sample(c->format);
+}
+
+static inline uint64_t clip_length_ms(const struct clip *c)
+{
+    return c->sample_rate ? c->frames * 1000 / c->sample_rate : 0;
+}
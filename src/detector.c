@@ -0,0 +1,355 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/**
+ * Most of the logic is directly taken from the obs noise gate filter:
+ * https://github.com/obsproject/obs-studio/blob/master/plugins/obs-filters/noise-gate-filter.c
+ */
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include <media-io/audio-math.h>
+
+#include "detector.h"
+
+static inline float ms_to_secf(int ms)
+{
+    return (float)ms / 1000.0f;
+}
+
+/* Times in the meter are stored as 31 bit values so they fit a long on every
+ * platform, differences stay correct for about 24 days
+ */
+#define METER_TIME_MASK 0x7fffffff
+
+/* The meter level is stored in millibels (1/100 dB), plenty for a readout
+ * and a plain long on every platform. Silence has no dB value.
+ */
+#define METER_SILENT_MB LONG_MIN
+
+/* Probes above open_threshold * SPARSE_MARGIN (-12 dB) trigger a full scan */
+#define SPARSE_MARGIN 0.25f
+
+/* Frames whose gain is computed before it's applied, small enough for the stack */
+#define GATE_CHUNK 256
+
+void detector_init(struct detector *d)
+{
+    pthread_mutex_init(&d->pending_mutex, NULL);
+    os_atomic_set_long(&d->meter_trigger, -1);
+}
+
+void detector_free(struct detector *d)
+{
+    pthread_mutex_destroy(&d->pending_mutex);
+}
+
+void detector_update(struct detector *d, const struct detector_settings *s, float sample_rate)
+{
+    d->cooldown = (uint64_t)s->cooldown_ms;
+
+    d->sample_rate_i = 1.0f / sample_rate;
+    d->open_threshold = db_to_mul(s->open_threshold_db);
+    d->close_threshold = db_to_mul(s->close_threshold_db);
+    d->attack_rate = 1.0f / (ms_to_secf(s->attack_time_ms) * sample_rate);
+    d->release_rate = 1.0f / (ms_to_secf(s->release_time_ms) * sample_rate);
+
+    const float threshold_diff = d->open_threshold - d->close_threshold;
+    const float min_decay_period = (1.0f / 75.0f) * sample_rate;
+
+    d->decay_rate = threshold_diff / min_decay_period;
+    d->hold_time = ms_to_secf(s->hold_time_ms);
+    d->scan_stride = s->scan_stride > 1 ? (size_t)s->scan_stride : 0;
+    d->lookahead = s->lookahead_blocks > 0 ? (size_t)s->lookahead_blocks : 0;
+    if (d->lookahead > DETECTOR_MAX_LOOKAHEAD)
+        d->lookahead = DETECTOR_MAX_LOOKAHEAD;
+    detector_reset_lookahead(d);
+    d->probe_offset = 0;
+    d->quiet = false;
+    d->approaching = false;
+    d->is_open = false;
+    d->attenuation = 0.0f;
+    d->level = 0.0f;
+    d->held_time = 0.0f;
+}
+
+void detector_post_update(struct detector *d, const struct detector_settings *s, float sample_rate)
+{
+    pthread_mutex_lock(&d->pending_mutex);
+    d->pending = *s;
+    d->pending_sample_rate = sample_rate;
+    os_atomic_set_bool(&d->has_pending, true);
+    pthread_mutex_unlock(&d->pending_mutex);
+}
+
+static inline void detector_apply_pending(struct detector *d)
+{
+    struct detector_settings s;
+    float sample_rate;
+
+    if (!os_atomic_load_bool(&d->has_pending))
+        return;
+
+    pthread_mutex_lock(&d->pending_mutex);
+    s = d->pending;
+    sample_rate = d->pending_sample_rate;
+    os_atomic_set_bool(&d->has_pending, false);
+    pthread_mutex_unlock(&d->pending_mutex);
+
+    detector_update(d, &s, sample_rate);
+}
+
+void detector_reset_lookahead(struct detector *d)
+{
+    d->history_pos = 0;
+    d->history_count = 0;
+    d->confirmed = false;
+}
+
+/* Adds the block to the lookahead ring and checks whether all of it agrees */
+static inline void detector_confirm(struct detector *d, float peak)
+{
+    const size_t size = d->lookahead + 1;
+
+    if (!d->lookahead) {
+        d->confirmed = d->is_open;
+        return;
+    }
+
+    d->history[d->history_pos].peak = peak;
+    d->history[d->history_pos].is_open = d->is_open;
+    d->history_pos = (d->history_pos + 1) % size;
+    if (d->history_count < size)
+        d->history_count++;
+
+    d->confirmed = d->history_count == size;
+    for (size_t i = 0; i < size && d->confirmed; i++)
+        d->confirmed = d->history[i].is_open && d->history[i].peak >= d->close_threshold;
+}
+
+static inline void detector_publish(struct detector *d, float peak)
+{
+    detector_confirm(d, peak);
+    d->approaching = (!d->is_open && peak >= d->close_threshold) || (d->is_open && !d->confirmed);
+    os_atomic_set_long(&d->meter_peak, peak > 0.0f ? lroundf(mul_to_db(peak) * 100.0f) : METER_SILENT_MB);
+    os_atomic_set_long(&d->meter_open, d->is_open);
+}
+
+/* Sparse scanning is only allowed while nothing but a loud frame could change
+ * the outcome: the gate is closed, fully released and the last block was quiet
+ */
+static inline bool detector_can_skip(const struct detector *d)
+{
+    return d->scan_stride && d->quiet && !d->is_open && d->attenuation <= 0.0f;
+}
+
+/* Next probe start, rotated so noise periodic with the stride can't hide */
+static inline size_t detector_next_probe(struct detector *d)
+{
+    size_t offset = d->probe_offset;
+    d->probe_offset = (offset + 1) % d->scan_stride;
+    return offset;
+}
+
+static inline float detector_probe(struct detector *d, float **data, size_t channels, size_t frames)
+{
+    float peak = 0.0f;
+    for (size_t i = detector_next_probe(d); i < frames; i += d->scan_stride) {
+        for (size_t j = 0; j < channels; j++)
+            peak = fmaxf(peak, fabsf(data[j][i]));
+    }
+    return peak;
+}
+
+/* Advances the state as if the skipped frames were all below the probe peak */
+static inline bool detector_try_skip(struct detector *d, float probe_peak, size_t frames)
+{
+    if (probe_peak >= d->open_threshold * SPARSE_MARGIN)
+        return false;
+
+    d->level = fmaxf(d->level - d->decay_rate * (float)frames, probe_peak - d->decay_rate);
+    d->held_time += d->sample_rate_i * (float)frames;
+    detector_publish(d, probe_peak);
+    return true;
+}
+
+static inline void detector_step(struct detector *d, float cur_level)
+{
+    if (cur_level > d->open_threshold && !d->is_open) {
+        d->is_open = true;
+    }
+    if (d->level < d->close_threshold && d->is_open) {
+        d->held_time = 0.0f;
+        d->is_open = false;
+    }
+
+    d->level = fmaxf(d->level, cur_level) - d->decay_rate;
+
+    if (d->is_open) {
+        d->attenuation = fminf(1.0f, d->attenuation + d->attack_rate);
+    } else {
+        d->held_time += d->sample_rate_i;
+        if (d->held_time > d->hold_time) {
+            d->attenuation = fmaxf(0.0f, d->attenuation - d->release_rate);
+        }
+    }
+}
+
+bool detector_process(struct detector *d, float **data, size_t channels, size_t frames)
+{
+    float peak = 0.0f;
+
+    detector_apply_pending(d);
+
+    if (detector_can_skip(d)) {
+        if (detector_try_skip(d, detector_probe(d, data, channels, frames), frames))
+            return d->is_open;
+    }
+
+    for (size_t i = 0; i < frames; i++) {
+        float cur_level = fabsf(data[0][i]);
+        for (size_t j = 0; j < channels; j++) {
+            cur_level = fmaxf(cur_level, fabsf(data[j][i]));
+        }
+        peak = fmaxf(peak, cur_level);
+        detector_step(d, cur_level);
+    }
+
+    d->quiet = peak < d->open_threshold * SPARSE_MARGIN;
+    detector_publish(d, peak);
+    return d->is_open;
+}
+
+/* Gains are either all 1 while the gate is fully open, all 0 while it's fully
+ * released or a ramp in between, only the ramp needs a multiply
+ */
+static inline void apply_gains(float **data, size_t channels, size_t offset, const float *gains, size_t frames,
+                               float min_gain, float max_gain)
+{
+    if (min_gain >= 1.0f)
+        return;
+
+    for (size_t j = 0; j < channels; j++) {
+        float *samples = data[j] + offset;
+        if (max_gain <= 0.0f) {
+            memset(samples, 0, sizeof(float) * frames);
+            continue;
+        }
+        for (size_t i = 0; i < frames; i++)
+            samples[i] *= gains[i];
+    }
+}
+
+bool detector_process_gate(struct detector *d, float **data, size_t channels, size_t frames)
+{
+    float gains[GATE_CHUNK];
+    float peak = 0.0f;
+
+    detector_apply_pending(d);
+
+    /* Skipping needs a fully released gate, so the whole block is silenced */
+    if (detector_can_skip(d)) {
+        if (detector_try_skip(d, detector_probe(d, data, channels, frames), frames)) {
+            apply_gains(data, channels, 0, NULL, frames, 0.0f, 0.0f);
+            return d->is_open;
+        }
+    }
+
+    for (size_t offset = 0; offset < frames; offset += GATE_CHUNK) {
+        size_t count = frames - offset < GATE_CHUNK ? frames - offset : GATE_CHUNK;
+        float min_gain = 1.0f, max_gain = 0.0f;
+
+        for (size_t i = 0; i < count; i++) {
+            float cur_level = fabsf(data[0][offset + i]);
+            for (size_t j = 0; j < channels; j++) {
+                cur_level = fmaxf(cur_level, fabsf(data[j][offset + i]));
+            }
+            peak = fmaxf(peak, cur_level);
+            detector_step(d, cur_level);
+            gains[i] = d->attenuation;
+            min_gain = fminf(min_gain, d->attenuation);
+            max_gain = fmaxf(max_gain, d->attenuation);
+        }
+        apply_gains(data, channels, offset, gains, count, min_gain, max_gain);
+    }
+
+    d->quiet = peak < d->open_threshold * SPARSE_MARGIN;
+    detector_publish(d, peak);
+    return d->is_open;
+}
+
+void detector_reduce_peaks(float *peaks, float **data, size_t channels, size_t frames)
+{
+    for (size_t i = 0; i < frames; i++) {
+        float cur_level = fabsf(data[0][i]);
+        for (size_t j = 0; j < channels; j++) {
+            cur_level = fmaxf(cur_level, fabsf(data[j][i]));
+        }
+        peaks[i] = cur_level;
+    }
+}
+
+bool detector_process_peaks(struct detector *d, const float *peaks, size_t frames)
+{
+    float peak = 0.0f;
+
+    detector_apply_pending(d);
+
+    if (detector_can_skip(d)) {
+        for (size_t i = detector_next_probe(d); i < frames; i += d->scan_stride)
+            peak = fmaxf(peak, peaks[i]);
+        if (detector_try_skip(d, peak, frames))
+            return d->is_open;
+        peak = 0.0f;
+    }
+
+    for (size_t i = 0; i < frames; i++) {
+        peak = fmaxf(peak, peaks[i]);
+        detector_step(d, peaks[i]);
+    }
+
+    d->quiet = peak < d->open_threshold * SPARSE_MARGIN;
+    detector_publish(d, peak);
+    return d->is_open;
+}
+
+bool detector_check_trigger(struct detector *d, uint64_t time_ms, uint64_t clip_length_ms)
+{
+    if (!d->is_open || !d->confirmed)
+        return false;
+    if (d->has_played && (time_ms - d->last_play_time) <= (clip_length_ms + d->cooldown))
+        return false;
+
+    d->has_played = true;
+    d->last_play_time = time_ms;
+    os_atomic_set_long(&d->meter_trigger, (long)(time_ms & METER_TIME_MASK));
+    return true;
+}
+
+void detector_get_meter(const struct detector *d, uint64_t time_ms, struct detector_meter *m)
+{
+    long peak_mb = os_atomic_load_long(&d->meter_peak);
+    long trigger = os_atomic_load_long(&d->meter_trigger);
+
+    m->peak_db = peak_mb == METER_SILENT_MB ? -INFINITY : (float)peak_mb / 100.0f;
+    m->is_open = os_atomic_load_long(&d->meter_open) != 0;
+    m->has_triggered = trigger >= 0;
+    m->since_trigger_ms = 0;
+    if (m->has_triggered)
+        m->since_trigger_ms = (uint64_t)(((long)(time_ms & METER_TIME_MASK) - trigger) & METER_TIME_MASK);
+}
@@ -0,0 +1,179 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <util/threading.h>
+
+/* Noise gate style level detector, shared between the filter and the offline
+ * tools so both run the exact same logic
+ */
+
+struct detector_settings {
+    float open_threshold_db;
+    float close_threshold_db;
+    int attack_time_ms;
+    int hold_time_ms;
+    int release_time_ms;
+    int cooldown_ms;
+    /* 0 scans every frame. Otherwise, while the gate is fully closed and the
+     * last block was far below the open threshold, only every scan_stride-th
+     * frame is looked at. See detector_process for what that costs
+     */
+    int scan_stride;
+    /* 0 triggers in the block the gate opens in. Otherwise the opening has
+     * to be confirmed by that many following blocks, see detector_check_trigger
+     */
+    int lookahead_blocks;
+};
+
+/* Longest confirmation, 8 blocks are ~170 ms at 48 kHz */
+#define DETECTOR_MAX_LOOKAHEAD 8
+
+/* What the lookahead keeps of every block */
+struct detector_block {
+    float peak;
+    bool is_open;
+};
+
+/* Snapshot of what the detector saw last, for showing it in the UI */
+struct detector_meter {
+    float peak_db;
+    bool is_open;
+    bool has_triggered;
+    uint64_t since_trigger_ms;
+};
+
+struct detector {
+    float sample_rate_i;
+
+    float open_threshold;
+    float close_threshold;
+    float decay_rate;
+    float attack_rate;
+    float release_rate;
+    float hold_time;
+
+    bool is_open;
+    float attenuation;
+    float level;
+    float held_time;
+
+    uint64_t cooldown;
+    uint64_t last_play_time;
+    bool has_played;
+
+    size_t scan_stride;
+    size_t probe_offset;
+    bool quiet;
+    /* The gate is closed but the last block got past the close threshold,
+     * or it is open and waits for the lookahead, a notification is likely
+     * to follow
+     */
+    bool approaching;
+
+    /* Ring of the last lookahead + 1 blocks, oldest at history_pos once full */
+    size_t lookahead;
+    struct detector_block history[DETECTOR_MAX_LOOKAHEAD + 1];
+    size_t history_pos;
+    size_t history_count;
+    /* The gate opened and stayed above the close threshold for the whole lookahead */
+    bool confirmed;
+
+    /* Settings posted from another thread, applied at the start of the next block */
+    pthread_mutex_t pending_mutex;
+    struct detector_settings pending;
+    float pending_sample_rate;
+    volatile bool has_pending;
+
+    /* Published once per block with plain atomic stores, never locked */
+    volatile long meter_peak;    /* block's peak in millibels, see detector.c */
+    volatile long meter_open;    /* gate state at the end of the block */
+    volatile long meter_trigger; /* low 31 bits of the last trigger time, -1 before the first */
+};
+
+/* Only needed when settings are posted with detector_post_update */
+void detector_init(struct detector *d);
+void detector_free(struct detector *d);
+
+/* Applies new settings and resets the gate state, must be called on the
+ * thread that processes audio
+ */
+void detector_update(struct detector *d, const struct detector_settings *s, float sample_rate);
+
+/* Same as detector_update, but safe to call from any thread while audio is
+ * being processed
+ */
+void detector_post_update(struct detector *d, const struct detector_settings *s, float sample_rate);
+
+/* Runs one block of planar float audio through the gate, returns whether the
+ * gate is open at the end of the block.
+ *
+ * With a scan_stride the block is first probed at every stride-th frame. If
+ * no probe reaches -12 dB below the open threshold the rest of the block is
+ * skipped, otherwise the whole block is scanned as usual. Only the frames
+ * after the last probe can go unseen, so sound that keeps the gate open for
+ * longer than stride frames delays the gate opening by at most one block. A
+ * tone stays above the probe level for ~84% of every half period, which
+ * leaves probes no gap to miss it in for frequencies up to
+ * 0.42 * sample_rate / stride (1.26 kHz at 48 kHz with a stride of 16),
+ * where voices carry most of their energy. Shorter clicks can be missed.
+ */
+bool detector_process(struct detector *d, float **data, size_t channels, size_t frames);
+
+/* Same as detector_process, but also works as the noise gate the detector
+ * was taken from: every sample is multiplied by the gate's attenuation of
+ * its frame, so the audio is gated in the same pass that detects speech.
+ * Gains are applied in small chunks, chunks where the gate is fully open are
+ * left alone and fully closed ones are cleared. A block skipped by the sparse
+ * scan is cleared as a whole.
+ */
+bool detector_process_gate(struct detector *d, float **data, size_t channels, size_t frames);
+
+/* Reduces planar audio to the per frame peak over all channels, which is the
+ * only thing the gate looks at
+ */
+void detector_reduce_peaks(float *peaks, float **data, size_t channels, size_t frames);
+
+/* Same as detector_process, but on audio already reduced with detector_reduce_peaks */
+bool detector_process_peaks(struct detector *d, const float *peaks, size_t frames);
+
+/* Reads the values published by the audio thread, time_ms is the same clock
+ * detector_check_trigger gets. Safe to call from any thread
+ */
+void detector_get_meter(const struct detector *d, uint64_t time_ms, struct detector_meter *m);
+
+/* Returns true if a notification should be played at time_ms (any monotonic
+ * millisecond clock) and records it as the last play time.
+ *
+ * With lookahead_blocks K, the gate has to be open at the end of the last
+ * K + 1 blocks and every one of them has to peak at or above the close
+ * threshold, so a click or cough that opens the gate for a block or two
+ * doesn't trigger. Only a summary per block is kept, so this costs O(K) per
+ * block and delays every notification by K blocks (~21 ms each at 48 kHz
+ * with obs' 1024 frame blocks)
+ */
+bool detector_check_trigger(struct detector *d, uint64_t time_ms, uint64_t clip_length_ms);
+
+/* Forgets the blocks the lookahead has seen. For callers that close the gate
+ * themselves, so blocks from before aren't counted towards the next opening
+ */
+void detector_reset_lookahead(struct detector *d);
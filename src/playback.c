@@ -0,0 +1,795 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <util/bmem.h>
+#include <util/base.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <util/profiler.h>
+
+#include "playback.h"
+#include "recycle.h"
+#include "plugin-macros.generated.h"
+
+static const char *profile_load_clip = "muted_load_clip";
+static const char *profile_open_device = "muted_open_device";
+
+#define TIME_MASK 0x7fffffff
+
+/* Only playback_play moves a voice out of FREE or PLAYING, and only with a
+ * compare and swap on the state, so a steal can't land on a voice the
+ * callback just freed. Everything else is the callback's
+ */
+enum voice_state {
+    VOICE_FREE,
+    VOICE_STARTING,
+    VOICE_PLAYING,
+    /* Stolen for a new notification, the callback hasn't seen it yet */
+    VOICE_STOLEN,
+    /* Fading out, starts over once the fade ended */
+    VOICE_FADING,
+};
+
+/* Free list head, see playback.free_voices. The tag stays below the sign bit */
+#define VOICE_INDEX_MASK 0xffff
+#define VOICE_NONE       0xffff
+#define VOICE_TAG_ONE    0x10000
+#define VOICE_TAG_MASK   0x7fff0000
+
+/* A stolen voice fades out this long before it restarts */
+#define VOICE_FADE_MS 5
+
+/* Samples mixed at once on the device thread's stack when voices overlap */
+#define MIX_CHUNK_SAMPLES 1024
+
+static inline long now_us(void)
+{
+    return (long)((os_gettime_ns() / 1000) & TIME_MASK);
+}
+
+/* Everything miniaudio needs for one open device. The context keeps a
+ * pointer to the log, so they live in one allocation that can be handed to
+ * another playback as a whole through the recycling pool
+ */
+struct playback_output {
+    ma_log log;
+    ma_log_callback log_cb;
+    ma_context context;
+    ma_device device;
+    bool has_device;
+    char *device_name;
+    /* What the device was opened for, see output_key */
+    char *key;
+    ma_thread_priority thread_priority;
+    uint64_t affinity;
+
+    /* Written by the device thread on its first callback after the device
+     * was opened, published through thread_configured
+     */
+    volatile bool thread_configured;
+    struct thread_sched_info thread_info;
+    bool realtime_denied;
+    bool affinity_denied;
+};
+
+/* Outputs are only interchangeable if their contexts use the same backends */
+static void output_key_prefix(struct dstr *key, const struct playback *p)
+{
+    dstr_copy(key, "output:");
+    for (ma_uint32 i = 0; i < p->backend_count; i++)
+        dstr_catf(key, "%d,", (int)p->backends[i]);
+    dstr_cat(key, "|");
+}
+
+/* The device is opened in the clip's format, so it is part of the key */
+static void output_key(struct dstr *key, const struct playback *p, const char *device, ma_thread_priority priority,
+                       uint64_t affinity)
+{
+    output_key_prefix(key, p);
+    dstr_catf(key, "%s|%d|%u|%u|%d|%llx", device, (int)p->clip.format, p->clip.channels, p->clip.sample_rate,
+              (int)priority, (unsigned long long)affinity);
+}
+
+static void close_device(struct playback_output *out)
+{
+    if (out->has_device)
+        ma_device_uninit(&out->device);
+    out->has_device = false;
+    os_atomic_set_bool(&out->thread_configured, false);
+    bfree(out->device_name);
+    bfree(out->key);
+    out->device_name = NULL;
+    out->key = NULL;
+}
+
+/* Runs on the pool's thread once nobody took the output */
+static void output_destroy(void *param)
+{
+    struct playback_output *out = param;
+
+    close_device(out);
+    ma_context_uninit(&out->context);
+    ma_log_uninit(&out->log);
+    bfree(out);
+}
+
+static struct playback_output *output_create(struct playback *p)
+{
+    struct playback_output *out = bzalloc(sizeof(*out));
+    ma_context_config cfg = ma_context_config_init();
+
+    if (ma_log_init(NULL, &out->log) != MA_SUCCESS) {
+        blog(LOG_ERROR, "Failed to init ma_log");
+        bfree(out);
+        return NULL;
+    }
+
+    out->log_cb = ma_log_callback_init(p->log_cb, p->log_param);
+    if (ma_log_register_callback(&out->log, out->log_cb) != MA_SUCCESS) {
+        blog(LOG_ERROR, "Failed to register log callback");
+        ma_log_uninit(&out->log);
+        bfree(out);
+        return NULL;
+    }
+
+    cfg.pUserData = p->log_param;
+    cfg.pLog = &out->log;
+
+    if (ma_context_init(p->backend_count ? p->backends : NULL, p->backend_count, &cfg, &out->context) !=
+        MA_SUCCESS) {
+        blog(LOG_ERROR, "Failed to initialize context.");
+        ma_log_uninit(&out->log);
+        bfree(out);
+        return NULL;
+    }
+    return out;
+}
+
+/* The previous owner's log callback was removed when it gave the output up */
+static void output_adopt(struct playback *p, struct playback_output *out)
+{
+    out->log_cb = ma_log_callback_init(p->log_cb, p->log_param);
+    ma_log_register_callback(&out->log, out->log_cb);
+    out->device.pUserData = p;
+    p->out = out;
+}
+
+/* Stops the device and leaves the output to the recycling pool. The owner
+ * may be freed right after, so its log callback goes too
+ */
+static void output_release(struct playback *p)
+{
+    struct playback_output *out = p->out;
+    struct dstr key = {0};
+
+    if (!out)
+        return;
+
+    if (out->has_device && ma_device_is_started(&out->device))
+        ma_device_stop(&out->device);
+    ma_log_unregister_callback(&out->log, out->log_cb);
+    out->device.pUserData = NULL;
+
+    if (out->key) {
+        dstr_copy(&key, out->key);
+    } else {
+        output_key_prefix(&key, p);
+    }
+    recycle_put(key.array, out, output_destroy);
+    dstr_free(&key);
+    p->out = NULL;
+}
+
+/* Only while neither the audio nor the device thread can get to the voices */
+static void reset_voices(struct playback *p)
+{
+    for (long i = 0; i < PLAYBACK_VOICES; i++) {
+        struct playback_voice *v = &p->voices[i];
+        memset(v, 0, sizeof(*v));
+        os_atomic_set_long(&v->state, VOICE_FREE);
+        os_atomic_set_long(&v->next, i + 1 < PLAYBACK_VOICES ? i + 1 : VOICE_NONE);
+    }
+    os_atomic_set_long(&p->free_voices, 0);
+    os_atomic_set_long(&p->active_voices, 0);
+}
+
+bool playback_init(struct playback *p, const ma_backend *backends, ma_uint32 backend_count, ma_log_callback_proc log_cb,
+                   void *log_param)
+{
+    struct dstr prefix = {0};
+
+    pthread_mutex_init(&p->device_mutex, NULL);
+    pthread_mutex_init(&p->clip_mutex, NULL);
+    reset_voices(p);
+
+    if (backends && backend_count <= ma_backend_null + 1) {
+        memcpy(p->backends, backends, backend_count * sizeof(ma_backend));
+        p->backend_count = backend_count;
+    }
+    p->log_cb = log_cb;
+    p->log_param = log_param;
+
+    /* Any recycled context will do, a better matching one is swapped in
+     * once the device is known
+     */
+    output_key_prefix(&prefix, p);
+    struct playback_output *out = recycle_take_prefix(prefix.array);
+    dstr_free(&prefix);
+
+    if (out)
+        output_adopt(p, out);
+    else
+        p->out = output_create(p);
+    return p->out != NULL;
+}
+
+static void clip_destroy(void *param)
+{
+    clip_free(param);
+    bfree(param);
+}
+
+/* Decoded files go to the recycling pool, the built-in sound isn't worth it */
+static void free_clip(struct playback *p)
+{
+    if (p->has_clip && p->clip.owned && p->clip_key)
+        recycle_put(p->clip_key, bmemdup(&p->clip, sizeof(p->clip)), clip_destroy);
+    else
+        clip_free(&p->clip);
+
+    memset(&p->clip, 0, sizeof(p->clip));
+    p->has_clip = false;
+    reset_voices(p);
+    bfree(p->file_path);
+    bfree(p->clip_key);
+    p->file_path = NULL;
+    p->clip_key = NULL;
+    os_atomic_set_long(&p->file_length, 0);
+}
+
+void playback_free(struct playback *p)
+{
+    /* The device goes first, its thread may still be reading the clip */
+    pthread_mutex_lock(&p->device_mutex);
+    pthread_mutex_lock(&p->clip_mutex);
+    output_release(p);
+    free_clip(p);
+    pthread_mutex_unlock(&p->clip_mutex);
+    pthread_mutex_unlock(&p->device_mutex);
+
+    pthread_mutex_destroy(&p->clip_mutex);
+    pthread_mutex_destroy(&p->device_mutex);
+}
+
+static inline bool has_device(const struct playback *p)
+{
+    return p->out && p->out->has_device;
+}
+
+/* Only the audio thread pops and only the device thread pushes, but the tag
+ * keeps the stack correct even with several of each
+ */
+static long voice_pop(struct playback *p)
+{
+    long head, next;
+
+    do {
+        head = os_atomic_load_long(&p->free_voices);
+        if ((head & VOICE_INDEX_MASK) == VOICE_NONE)
+            return -1;
+        next = ((head + VOICE_TAG_ONE) & VOICE_TAG_MASK) |
+               os_atomic_load_long(&p->voices[head & VOICE_INDEX_MASK].next);
+    } while (!os_atomic_compare_swap_long(&p->free_voices, head, next));
+    return head & VOICE_INDEX_MASK;
+}
+
+static void voice_push(struct playback *p, long index)
+{
+    long head;
+
+    do {
+        head = os_atomic_load_long(&p->free_voices);
+        os_atomic_set_long(&p->voices[index].next, head & VOICE_INDEX_MASK);
+    } while (!os_atomic_compare_swap_long(&p->free_voices, head, ((head + VOICE_TAG_ONE) & VOICE_TAG_MASK) | index));
+}
+
+/* The playing voice that was claimed first, NULL if every voice is free or
+ * already starting over
+ */
+static struct playback_voice *oldest_voice(struct playback *p)
+{
+    struct playback_voice *oldest = NULL;
+    for (size_t i = 0; i < PLAYBACK_VOICES; i++) {
+        struct playback_voice *v = &p->voices[i];
+        if (os_atomic_load_long(&v->state) == VOICE_PLAYING && (!oldest || v->start < oldest->start))
+            oldest = v;
+    }
+    return oldest;
+}
+
+/* A free voice, else the oldest playing one is stolen. A voice the callback
+ * is just freeing is neither, that is retried a few times. False if the
+ * notification was dropped
+ */
+static bool voice_claim(struct playback *p, long play_time, bool warm)
+{
+    for (int attempt = 0; attempt <= PLAYBACK_VOICES; attempt++) {
+        long index = voice_pop(p);
+        struct playback_voice *v = index >= 0 ? &p->voices[index] : oldest_voice(p);
+
+        if (!v)
+            break;
+
+        /* Only read by the callback once the state below says so */
+        os_atomic_set_long(&v->play_time_us, play_time);
+        os_atomic_set_bool(&v->play_warm, warm);
+        if (index >= 0) {
+            os_atomic_inc_long(&p->active_voices);
+            os_atomic_set_long(&v->state, VOICE_STARTING);
+        } else if (os_atomic_compare_swap_long(&v->state, VOICE_PLAYING, VOICE_STOLEN)) {
+            p->steals++;
+        } else {
+            continue;
+        }
+        v->start = p->voice_starts++;
+        return true;
+    }
+    return false;
+}
+
+void playback_play(struct playback *p)
+{
+    /* Don't stall the audio thread while the UI thread reopens things */
+    if (pthread_mutex_trylock(&p->device_mutex) != 0)
+        return;
+
+    if (has_device(p)) {
+        bool warm = ma_device_is_started(&p->out->device);
+        long play_time = now_us();
+
+        /* A voice is only claimed on a running device, a failed start
+         * leaves the pool as it was
+         */
+        if (!warm && ma_device_start(&p->out->device) != MA_SUCCESS) {
+            blog(LOG_ERROR, "Failed to start playback.");
+            pthread_mutex_unlock(&p->device_mutex);
+            return;
+        }
+
+        p->last_use_ns = os_gettime_ns();
+        /* Every voice started over since the last callback, this
+         * notification would sound together with one of them anyway
+         */
+        if (!voice_claim(p, play_time, warm))
+            p->dropped++;
+        blog(LOG_DEBUG, "Playing audio");
+    }
+    pthread_mutex_unlock(&p->device_mutex);
+}
+
+void playback_prepare(struct playback *p)
+{
+    pthread_mutex_lock(&p->device_mutex);
+
+    if (has_device(p)) {
+        p->last_use_ns = os_gettime_ns();
+        if (!ma_device_is_started(&p->out->device)) {
+            if (ma_device_start(&p->out->device) == MA_SUCCESS)
+                p->prepares++;
+            else
+                blog(LOG_ERROR, "Failed to start playback.");
+        }
+    }
+    pthread_mutex_unlock(&p->device_mutex);
+}
+
+void playback_release_idle(struct playback *p, uint64_t idle_ms)
+{
+    pthread_mutex_lock(&p->device_mutex);
+    if (has_device(p) && ma_device_is_started(&p->out->device) && !playback_is_playing(p) &&
+        os_gettime_ns() - p->last_use_ns >= idle_ms * 1000000) {
+        ma_device_stop(&p->out->device);
+        p->releases++;
+    }
+    pthread_mutex_unlock(&p->device_mutex);
+}
+
+/* A file that was changed since it was decoded gets a different key */
+static void clip_key(struct dstr *key, const char *path, ma_format format)
+{
+    struct stat st = {0};
+    os_stat(path, &st);
+    dstr_printf(key, "clip:%s|%d|%lld|%lld", path, (int)format, (long long)st.st_size, (long long)st.st_mtime);
+}
+
+static void load_clip(struct playback *p, const char *path, bool compact)
+{
+    ma_format format = compact ? ma_format_s16 : ma_format_f32;
+    struct dstr key = {0};
+    bool fallback = false;
+
+    if (!*path) {
+        clip_load_builtin(&p->clip);
+    } else {
+        clip_key(&key, path, format);
+        struct clip *recycled = recycle_take(key.array);
+        if (recycled) {
+            p->clip = *recycled;
+            bfree(recycled);
+        } else if (!clip_load_file(&p->clip, path, format)) {
+            /* Keeps the path so the same file isn't retried on every update */
+            blog(LOG_WARNING, "Failed to load '%s', playing the built-in sound instead", path);
+            dstr_free(&key);
+            clip_load_builtin(&p->clip);
+            fallback = true;
+        }
+    }
+
+    os_atomic_set_bool(&p->clip_fallback, fallback);
+    p->has_clip = true;
+    p->clip_key = key.array;
+    bfree(p->file_path);
+    p->file_path = bstrdup(path);
+    p->compact = compact;
+    os_atomic_set_long(&p->file_length, (long)clip_length_ms(&p->clip));
+}
+
+/* Runs on the callback thread, some backends (e.g. CoreAudio) call from a
+ * thread they own so this can't be done when the device is created
+ */
+static void configure_thread(struct playback_output *out)
+{
+    bool affinity_ok = true, realtime_ok = true;
+
+    if (out->affinity)
+        affinity_ok = thread_set_affinity(out->affinity);
+
+    thread_get_sched_info(&out->thread_info);
+    if (out->thread_priority == ma_thread_priority_realtime && strcmp(out->thread_info.policy, "SCHED_FIFO") != 0 &&
+        strcmp(out->thread_info.policy, "SCHED_RR") != 0 && strcmp(out->thread_info.policy, "TIME_CRITICAL") != 0) {
+        realtime_ok = thread_set_realtime();
+        thread_get_sched_info(&out->thread_info);
+    }
+
+    blog(affinity_ok && realtime_ok ? LOG_INFO : LOG_WARNING,
+         "Playback thread: %s priority %d, affinity 0x%llx%s%s", out->thread_info.policy, out->thread_info.priority,
+         (unsigned long long)out->thread_info.affinity, affinity_ok ? "" : " (failed to set affinity)",
+         realtime_ok ? "" : " (real time scheduling denied)");
+    out->realtime_denied = !realtime_ok;
+    out->affinity_denied = !affinity_ok;
+    os_atomic_set_bool(&out->thread_configured, true);
+}
+
+/* Starts the voice's sound over, for a new claim or after a steal's fade */
+static void voice_begin(struct playback *p, struct playback_voice *v)
+{
+    long latency = (now_us() - os_atomic_load_long(&v->play_time_us)) & TIME_MASK;
+    if (os_atomic_load_bool(&v->play_warm)) {
+        os_atomic_inc_long(&p->warm_starts);
+        os_atomic_set_long(&p->warm_latency_us, (os_atomic_load_long(&p->warm_latency_us) + latency) & TIME_MASK);
+    } else {
+        os_atomic_inc_long(&p->cold_starts);
+        os_atomic_set_long(&p->cold_latency_us, (os_atomic_load_long(&p->cold_latency_us) + latency) & TIME_MASK);
+    }
+    v->cursor = 0;
+    v->gain = 1.0f;
+    v->fade = 0;
+}
+
+/* Adds frames of the voice to mix. A fading voice ramps down to silence and
+ * starts over once the fade or the clip ended
+ */
+static void voice_mix(struct playback *p, struct playback_voice *v, float *mix, float *tmp, uint32_t frames,
+                      uint32_t channels)
+{
+    bool looping = os_atomic_load_bool(&p->looping);
+
+    while (frames && v->cursor < p->clip.frames) {
+        uint64_t left = p->clip.frames - v->cursor;
+        uint32_t count = frames < left ? frames : (uint32_t)left;
+        bool faded = false;
+
+        if (v->fade && v->fade < count)
+            count = v->fade;
+        clip_read(&p->clip, v->cursor, tmp, ma_format_f32, count);
+
+        if (v->fade) {
+            float step = v->gain / (float)v->fade;
+            for (uint32_t i = 0; i < count; i++) {
+                v->gain -= step;
+                for (uint32_t c = 0; c < channels; c++)
+                    mix[i * channels + c] += tmp[i * channels + c] * v->gain;
+            }
+            v->fade -= count;
+            faded = v->fade == 0;
+        } else {
+            for (size_t i = 0; i < (size_t)count * channels; i++)
+                mix[i] += tmp[i] * v->gain;
+        }
+
+        v->cursor += count;
+        mix += (size_t)count * channels;
+        frames -= count;
+
+        if (faded || (v->fade && v->cursor == p->clip.frames)) {
+            voice_begin(p, v);
+            os_atomic_set_long(&v->state, VOICE_PLAYING);
+        } else if (v->cursor == p->clip.frames && looping)
+            v->cursor = 0;
+    }
+}
+
+static void playback_cb(ma_device *dev, void *output, const void *input, ma_uint32 frame_count)
+{
+    UNUSED_PARAMETER(input);
+    struct playback *p = dev->pUserData;
+    struct playback_output *out = (struct playback_output *)((uint8_t *)dev - offsetof(struct playback_output, device));
+    struct playback_voice *single = NULL;
+    size_t playing = 0;
+
+    if (!os_atomic_load_bool(&out->thread_configured))
+        configure_thread(out);
+
+    /* Output stays silent while the clip is being replaced */
+    if (pthread_mutex_trylock(&p->clip_mutex) != 0)
+        return;
+
+    if (!p->has_clip)
+        goto end;
+
+    for (size_t i = 0; i < PLAYBACK_VOICES; i++) {
+        struct playback_voice *v = &p->voices[i];
+        long state = os_atomic_load_long(&v->state);
+
+        if (state == VOICE_STARTING) {
+            voice_begin(p, v);
+            os_atomic_set_long(&v->state, VOICE_PLAYING);
+        } else if (state == VOICE_STOLEN) {
+            /* Jumping back to the start would click, a voice that already
+             * played to the end just starts over
+             */
+            v->fade = v->cursor < p->clip.frames ? p->clip.sample_rate * VOICE_FADE_MS / 1000 : 0;
+            if (!v->fade)
+                voice_begin(p, v);
+            os_atomic_set_long(&v->state, v->fade ? VOICE_FADING : VOICE_PLAYING);
+        } else if (state != VOICE_PLAYING && state != VOICE_FADING) {
+            continue;
+        }
+        single = v;
+        playing++;
+    }
+
+    uint8_t *dst = output;
+    uint32_t channels = dev->playback.channels;
+    uint32_t frame_size = ma_get_bytes_per_frame(dev->playback.format, channels);
+
+    if (playing == 1 && !single->fade) {
+        /* A single voice is copied straight into the device's format. A
+         * loop restarts within the same buffer, so there's no gap between
+         * repetitions and the device keeps running
+         */
+        while (frame_count && single->cursor < p->clip.frames) {
+            uint64_t left = p->clip.frames - single->cursor;
+            uint32_t frames = frame_count < left ? frame_count : (uint32_t)left;
+            clip_read(&p->clip, single->cursor, dst, dev->playback.format, frames);
+            single->cursor += frames;
+            dst += (size_t)frames * frame_size;
+            frame_count -= frames;
+
+            if (single->cursor == p->clip.frames && os_atomic_load_bool(&p->looping))
+                single->cursor = 0;
+        }
+    } else if (playing) {
+        float mix[MIX_CHUNK_SAMPLES], tmp[MIX_CHUNK_SAMPLES];
+        uint32_t chunk = MIX_CHUNK_SAMPLES / channels;
+
+        while (frame_count) {
+            uint32_t frames = frame_count < chunk ? frame_count : chunk;
+            memset(mix, 0, sizeof(float) * frames * channels);
+            for (size_t i = 0; i < PLAYBACK_VOICES; i++) {
+                long state = os_atomic_load_long(&p->voices[i].state);
+                if (state == VOICE_PLAYING || state == VOICE_FADING)
+                    voice_mix(p, &p->voices[i], mix, tmp, frames, channels);
+            }
+            ma_convert_pcm_frames_format(dst, dev->playback.format, mix, ma_format_f32, frames, channels,
+                                         ma_dither_mode_none);
+            dst += (size_t)frames * frame_size;
+            frame_count -= frames;
+        }
+    }
+
+    /* Voices that ended go back to the free list. One stolen just now
+     * fails the swap and starts over in the next callback
+     */
+    for (long i = 0; i < PLAYBACK_VOICES; i++) {
+        struct playback_voice *v = &p->voices[i];
+        if (v->cursor < p->clip.frames || !os_atomic_compare_swap_long(&v->state, VOICE_PLAYING, VOICE_FREE))
+            continue;
+        os_atomic_dec_long(&p->active_voices);
+        voice_push(p, i);
+    }
+
+end:
+    pthread_mutex_unlock(&p->clip_mutex);
+}
+
+static void open_device(struct playback *p, const char *device, const char *key, ma_thread_priority priority,
+                        uint64_t affinity)
+{
+    struct playback_output *out = p->out;
+    ma_device_info *pPlaybackDevices;
+    ma_uint32 playbackDeviceCount;
+    ma_result result = ma_context_get_devices(&out->context, &pPlaybackDevices, &playbackDeviceCount, NULL, NULL);
+    ma_device_config deviceConfig;
+    ma_device_info *pPlaybackDevice = NULL;
+
+    if (result != MA_SUCCESS) {
+        blog(LOG_ERROR, "Failed to enumerate audio devices.");
+        return;
+    }
+
+    // Find the device with the specified name
+    for (ma_uint32 i = 0; i < playbackDeviceCount; ++i) {
+        if (strcmp(pPlaybackDevices[i].name, device) == 0) {
+            pPlaybackDevice = &pPlaybackDevices[i];
+            break;
+        }
+    }
+
+    if (pPlaybackDevice == NULL) {
+        blog(LOG_ERROR, "Failed to find playback device with name '%s'", device);
+        return;
+    }
+
+    // open device using the info in ma_device_info
+    deviceConfig = ma_device_config_init(ma_device_type_playback);
+    deviceConfig.playback.channels = p->clip.channels;
+    deviceConfig.sampleRate = p->clip.sample_rate;
+    deviceConfig.dataCallback = playback_cb;
+    deviceConfig.pUserData = p;
+    deviceConfig.playback.pDeviceID = &pPlaybackDevice->id;
+
+    /* s16 clips go out untouched if the device's native format is s16,
+     * anything else gets f32 which the callback converts to
+     */
+    deviceConfig.playback.format = p->clip.format == ma_format_s16 ? ma_format_unknown : ma_format_f32;
+
+    /* Only read when a device creates its thread, so no context re-init is needed to change it */
+    out->context.threadPriority = priority;
+    out->thread_priority = priority;
+    out->affinity = affinity;
+
+    result = ma_device_init(&out->context, &deviceConfig, &out->device);
+    if (result == MA_SUCCESS && out->device.playback.format != p->clip.format &&
+        out->device.playback.format != ma_format_f32) {
+        ma_device_uninit(&out->device);
+        deviceConfig.playback.format = ma_format_f32;
+        result = ma_device_init(&out->context, &deviceConfig, &out->device);
+    }
+
+    if (result == MA_SUCCESS) {
+        blog(LOG_INFO, "Opened '%s' (%s)", device, ma_get_format_name(out->device.playback.format));
+        out->has_device = true;
+        out->device_name = bstrdup(device);
+        out->key = bstrdup(key);
+    } else {
+        blog(LOG_ERROR, "Failed to open playback device '%s'", device);
+    }
+}
+
+/* An output that already has this device open in the right format is used
+ * as is, our own or one from the recycling pool. Ours goes to the pool then
+ */
+static void update_device(struct playback *p, const char *device, ma_thread_priority priority, uint64_t affinity)
+{
+    struct dstr key = {0};
+
+    output_key(&key, p, device, priority, affinity);
+    if (p->out->key && strcmp(p->out->key, key.array) == 0) {
+        dstr_free(&key);
+        return;
+    }
+
+    struct playback_output *out = recycle_take(key.array);
+    if (out) {
+        output_release(p);
+        output_adopt(p, out);
+        blog(LOG_INFO, "Reusing '%s' (%s)", device, ma_get_format_name(out->device.playback.format));
+    } else {
+        close_device(p->out);
+        profile_start(profile_open_device);
+        open_device(p, device, key.array, priority, affinity);
+        profile_end(profile_open_device);
+    }
+    dstr_free(&key);
+}
+
+void playback_update(struct playback *p, const struct playback_settings *s)
+{
+    const char *path = s->path ? s->path : "";
+    const char *device = s->device;
+    bool file_changed = !p->file_path || strcmp(path, p->file_path) != 0 || (*path && s->compact != p->compact);
+    bool device_changed = !has_device(p) || strcmp(device, p->out->device_name) != 0 ||
+                          s->thread_priority != p->out->thread_priority || s->affinity != p->out->affinity;
+
+    if (!p->out || (!file_changed && !device_changed))
+        return;
+
+    /* Always in this order, the device thread only ever tries the clip lock */
+    pthread_mutex_lock(&p->device_mutex);
+    pthread_mutex_lock(&p->clip_mutex);
+
+    if (file_changed) {
+        free_clip(p);
+        profile_start(profile_load_clip);
+        load_clip(p, path, s->compact);
+        profile_end(profile_load_clip);
+    }
+
+    /* The device is opened in the file's format, so it has to follow the file */
+    if (p->has_clip)
+        update_device(p, device, s->thread_priority, s->affinity);
+    else
+        close_device(p->out);
+
+    pthread_mutex_unlock(&p->clip_mutex);
+    pthread_mutex_unlock(&p->device_mutex);
+}
+
+void playback_enum_devices(struct playback *p, void (*cb)(void *param, const char *name), void *param)
+{
+    ma_device_info *devices;
+    ma_uint32 count;
+
+    /* The output can be swapped for a recycled one while settings change */
+    pthread_mutex_lock(&p->device_mutex);
+    if (p->out && ma_context_get_devices(&p->out->context, &devices, &count, NULL, NULL) == MA_SUCCESS) {
+        for (ma_uint32 i = 0; i < count; i++)
+            cb(param, devices[i].name);
+    } else {
+        blog(LOG_ERROR, "ma_context_get_devices failed");
+    }
+    pthread_mutex_unlock(&p->device_mutex);
+}
+
+void playback_get_stats(struct playback *p, struct playback_stats *stats)
+{
+    /* Keeps the device from being reopened, which rewrites the thread info */
+    pthread_mutex_lock(&p->device_mutex);
+    stats->thread_known = p->out && os_atomic_load_bool(&p->out->thread_configured);
+    if (stats->thread_known) {
+        stats->thread = p->out->thread_info;
+        stats->realtime_denied = p->out->realtime_denied;
+        stats->affinity_denied = p->out->affinity_denied;
+    }
+    stats->prepares = p->prepares;
+    stats->releases = p->releases;
+    stats->steals = p->steals;
+    stats->dropped = p->dropped;
+    pthread_mutex_unlock(&p->device_mutex);
+
+    stats->warm_starts = (uint32_t)os_atomic_load_long(&p->warm_starts);
+    stats->cold_starts = (uint32_t)os_atomic_load_long(&p->cold_starts);
+    stats->warm_latency_ms =
+        stats->warm_starts ? (double)os_atomic_load_long(&p->warm_latency_us) / 1000.0 / stats->warm_starts : 0.0;
+    stats->cold_latency_ms =
+        stats->cold_starts ? (double)os_atomic_load_long(&p->cold_latency_us) / 1000.0 / stats->cold_starts : 0.0;
+}
@@ -0,0 +1,229 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <miniaudio.h>
+#include <util/threading.h>
+
+#include "clip.h"
+#include "thread-util.h"
+
+/* Everything needed to play the notification sound on one output device.
+ * Settings are changed from the UI thread, playback is triggered from the
+ * audio thread and the device thread reads the clip, so the device and the
+ * clip are each guarded by a mutex. The audio and device threads only ever
+ * try to lock, they skip their work rather than wait for a reconfiguration.
+ */
+struct playback_settings {
+    /* Empty selects the built-in sound */
+    const char *path;
+    const char *device;
+    /* Keep the sound as s16 instead of f32 */
+    bool compact;
+    /* Priority of the device thread if the backend creates it through
+     * miniaudio, realtime also requests the fifo class on Linux
+     */
+    ma_thread_priority thread_priority;
+    /* CPUs the callback thread is pinned to, 0 leaves it alone */
+    uint64_t affinity;
+};
+
+struct playback_stats {
+    /* Scheduling the callback thread actually got, known after its first callback */
+    bool thread_known;
+    struct thread_sched_info thread;
+    /* Real time priority or the cpu pinning was asked for and refused */
+    bool realtime_denied;
+    bool affinity_denied;
+
+    /* Average time from playback_play to the callback that starts the sound.
+     * Warm starts found the device already running (played recently or
+     * prepared), cold starts had to start it first
+     */
+    uint32_t warm_starts;
+    uint32_t cold_starts;
+    double warm_latency_ms;
+    double cold_latency_ms;
+    /* Devices started by playback_prepare and stopped again by playback_release_idle */
+    uint32_t prepares;
+    uint32_t releases;
+    /* Notifications that restarted the oldest voice because all were playing */
+    uint32_t steals;
+    /* Notifications that came while every voice was starting over already */
+    uint32_t dropped;
+};
+
+/* Sounds that can play over each other, e.g. a retrigger while the last one
+ * is still playing. All voices read the same clip and are set up with the
+ * playback, so starting one never allocates or waits
+ */
+#define PLAYBACK_VOICES 4
+
+/* One playing instance of the clip. Claimed by playback_play on the audio
+ * thread, everything else belongs to the device thread which returns the
+ * voice once it played to the end
+ */
+struct playback_voice {
+    /* enum voice_state, see playback.c */
+    volatile long state;
+    /* Next voice in the free list while free */
+    volatile long next;
+    /* Order of claims, the lowest is stolen first. Guarded by device_mutex */
+    long start;
+
+    /* Device thread only */
+    uint64_t cursor;
+    float gain;
+    /* Frames left of the fade out before a stolen voice restarts */
+    uint32_t fade;
+
+    /* Set by playback_play before the voice is handed over, read by the
+     * callback that starts it. Microseconds are kept to 31 bits, only
+     * differences count
+     */
+    volatile long play_time_us;
+    volatile bool play_warm;
+};
+
+/* Log, context and open device, see playback.c */
+struct playback_output;
+
+struct playback {
+    /* Context configuration, kept to find a matching output in the recycling pool */
+    ma_backend backends[ma_backend_null + 1];
+    ma_uint32 backend_count;
+    ma_log_callback_proc log_cb;
+    void *log_param;
+    struct playback_output *out;
+
+    char *file_path;
+    /* Identity of the decoded file, for handing it to the recycling pool */
+    char *clip_key;
+    bool compact;
+    bool has_clip;
+    /* file_path didn't load, the built-in sound plays instead */
+    volatile bool clip_fallback;
+
+    struct clip clip;
+    struct playback_voice voices[PLAYBACK_VOICES];
+    /* Lock free stack of free voices: index in the low 16 bits, the bits
+     * above count pushes and pops so a head that was popped and pushed
+     * again in between doesn't compare equal
+     */
+    volatile long free_voices;
+    /* Claimed and not yet returned, so the sound is still playing */
+    volatile long active_voices;
+
+    pthread_mutex_t device_mutex;
+    pthread_mutex_t clip_mutex;
+    volatile long file_length;
+    /* Set by the audio thread, makes the callback wrap around at the end of
+     * the clip instead of stopping. It wraps within the same buffer, so the
+     * repetitions follow each other without a gap or a device restart
+     */
+    volatile bool looping;
+
+    /* Last prepare or play, guarded by device_mutex */
+    uint64_t last_use_ns;
+    uint32_t prepares;
+    uint32_t releases;
+    uint32_t steals;
+    uint32_t dropped;
+    long voice_starts;
+    /* Written by the callback only, the latency sums wrap after ~35 minutes */
+    volatile long warm_starts;
+    volatile long cold_starts;
+    volatile long warm_latency_us;
+    volatile long cold_latency_us;
+};
+
+/* Creates the miniaudio context, backends may be NULL to use the default
+ * order. Log messages are forwarded to log_cb. A context with the same
+ * backends is taken over from the recycling pool if there is one
+ */
+bool playback_init(struct playback *p, const ma_backend *backends, ma_uint32 backend_count, ma_log_callback_proc log_cb,
+                   void *log_param);
+
+/* The context with its open device and the decoded file go to the recycling
+ * pool, stopped, so an instance created soon after can continue with them
+ */
+void playback_free(struct playback *p);
+
+/* Loads the file and opens the device with the given name if either changed,
+ * the device is opened with the sample rate and channels of the file. Files
+ * and devices released by other instances are taken from the recycling pool
+ * if they match exactly
+ */
+void playback_update(struct playback *p, const struct playback_settings *s);
+
+/* Calls cb with the name of every output device, blocks while the playback
+ * is being reconfigured
+ */
+void playback_enum_devices(struct playback *p, void (*cb)(void *param, const char *name), void *param);
+
+/* Starts the sound on a free voice, safe to call from the audio thread.
+ * Never allocates or waits. With all voices playing, the one started first
+ * fades out over a few milliseconds and restarts for the new notification
+ */
+void playback_play(struct playback *p);
+
+/* Starts the device ahead of a likely playback_play, which then only has to
+ * wait for the next callback. Blocks while the device starts, so like
+ * playback_release_idle it doesn't belong on the audio thread
+ */
+void playback_prepare(struct playback *p);
+
+/* Stops the device if nothing is playing and it wasn't prepared or played
+ * for idle_ms. Blocks until the device thread has stopped, so it doesn't
+ * belong on the audio thread
+ */
+void playback_release_idle(struct playback *p, uint64_t idle_ms);
+
+/* While set, the sound repeats gaplessly inside the device callback. Once
+ * cleared the current repetition plays to its end. Safe to call from any
+ * thread and cheap enough to call for every audio block
+ */
+static inline void playback_set_looping(struct playback *p, bool looping)
+{
+    os_atomic_set_bool(&p->looping, looping);
+}
+
+/* True from playback_play until every voice (or its last repetition) ended */
+static inline bool playback_is_playing(struct playback *p)
+{
+    return os_atomic_load_long(&p->active_voices) > 0;
+}
+
+void playback_get_stats(struct playback *p, struct playback_stats *stats);
+
+/* True while a custom file failed to load and the built-in sound stands in.
+ * Safe to call from any thread
+ */
+static inline bool playback_clip_failed(struct playback *p)
+{
+    return os_atomic_load_bool(&p->clip_fallback);
+}
+
+/* Length of the loaded sound in milliseconds */
+static inline uint64_t playback_file_length(struct playback *p)
+{
+    return (uint64_t)os_atomic_load_long(&p->file_length);
+}
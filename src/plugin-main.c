@@ -16,15 +16,21 @@
  ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
  **/
 
-/**
- * Most of the logic is directly taken from the obs noise gate filter:
- * https://github.com/obsproject/obs-studio/blob/master/plugins/obs-filters/noise-gate-filter.c
- */
-#include <media-io/audio-math.h>
 #include <obs-module.h>
+#include <util/darray.h>
+#include <util/dstr.h>
 #include <util/platform.h>
-#include <miniaudio.h>
-
+#include <util/profiler.h>
+
+#include "atomic-ptr.h"
+#include "detector.h"
+#include "playback.h"
+#include "reaper.h"
+#include "recycle.h"
+#include "registry.h"
+#include "state-query.h"
+#include "talk-log.h"
+#include "task-pool.h"
 #include "plugin-macros.generated.h"
 
 /* clang-format off */
@@ -35,7 +41,19 @@
 #define S_HOLD_TIME         "hold_time"
 #define S_RELEASE_TIME      "release_time"
 #define S_FILE              "file"
+#define S_FILE_STATUS       "file_status"
 #define S_DEVICE            "device"
+#define S_COMPACT           "compact_clip"
+#define S_PRIORITY          "thread_priority"
+#define S_AFFINITY          "cpu_affinity"
+#define S_SPARSE_SCAN       "sparse_scan"
+#define S_CONTINUOUS        "continuous"
+#define S_PREWARM           "prewarm"
+#define S_GATE              "gate"
+#define S_LOOKAHEAD         "lookahead_blocks"
+#define S_TAP               "analysis_tap"
+#define S_METER             "meter"
+#define S_METER_REFRESH     "meter_refresh"
 
 #define MT_                            obs_module_text
 #define TEXT_OPEN_THRESHOLD            MT_("NoiseGate.OpenThreshold")
@@ -45,42 +63,151 @@
 #define TEXT_RELEASE_TIME              MT_("NoiseGate.ReleaseTime")
 #define TEXT_COOLDOWN                  MT_("Cooldown")
 #define TEXT_FILE                      MT_("File")
+#define TEXT_FILE_TOOLTIP              MT_("File.Tooltip")
+#define TEXT_FILE_FAILED               MT_("File.Failed")
 #define TEXT_DEVICE                    MT_("Device")
+#define TEXT_COMPACT                   MT_("CompactClip")
+#define TEXT_COMPACT_TOOLTIP           MT_("CompactClip.Tooltip")
+#define TEXT_PRIORITY                  MT_("ThreadPriority")
+#define TEXT_PRIORITY_TOOLTIP          MT_("ThreadPriority.Tooltip")
+#define TEXT_PRIORITY_NORMAL           MT_("ThreadPriority.Normal")
+#define TEXT_PRIORITY_HIGH             MT_("ThreadPriority.High")
+#define TEXT_PRIORITY_HIGHEST          MT_("ThreadPriority.Highest")
+#define TEXT_PRIORITY_REALTIME         MT_("ThreadPriority.Realtime")
+#define TEXT_AFFINITY                  MT_("CpuAffinity")
+#define TEXT_AFFINITY_TOOLTIP          MT_("CpuAffinity.Tooltip")
+#define TEXT_SPARSE_SCAN               MT_("SparseScan")
+#define TEXT_SPARSE_SCAN_TOOLTIP       MT_("SparseScan.Tooltip")
+#define TEXT_CONTINUOUS                MT_("Continuous")
+#define TEXT_CONTINUOUS_TOOLTIP        MT_("Continuous.Tooltip")
+#define TEXT_PREWARM                   MT_("Prewarm")
+#define TEXT_PREWARM_TOOLTIP           MT_("Prewarm.Tooltip")
+#define TEXT_GATE                      MT_("Gate")
+#define TEXT_GATE_TOOLTIP              MT_("Gate.Tooltip")
+#define TEXT_LOOKAHEAD                 MT_("Lookahead")
+#define TEXT_LOOKAHEAD_TOOLTIP         MT_("Lookahead.Tooltip")
+#define TEXT_TAP                       MT_("Tap")
+#define TEXT_TAP_TOOLTIP               MT_("Tap.Tooltip")
+#define TEXT_TAP_FILTER                MT_("Tap.Filter")
+#define TEXT_TAP_OUTPUT                MT_("Tap.Output")
+#define TEXT_METER_REFRESH             MT_("Meter.Refresh")
+#define TEXT_METER_NOT_MUTED           MT_("Meter.NotMuted")
+#define TEXT_METER_OPEN                MT_("Meter.Open")
+#define TEXT_METER_CLOSED              MT_("Meter.Closed")
+#define TEXT_METER_NEVER               MT_("Meter.Never")
+#define TEXT_METER_LEVEL               MT_("Meter.Level")
+#define TEXT_METER_GATE                MT_("Meter.Gate")
+#define TEXT_METER_LAST                MT_("Meter.LastNotification")
 
 #define VOL_MIN -96.0
 #define VOL_MAX 0.0
 
+/* Probe stride of the sparse scan, see detector_process for the latency it costs */
+#define SPARSE_SCAN_STRIDE 16
+
+/* With pre-warming the device is stopped again after this long without a
+ * prepare or notification
+ */
+#define PREWARM_IDLE_MS 5000
+
+/* How long released devices and sounds wait for a new filter to take them
+ * over, long enough for a scene collection switch
+ */
+#define RECYCLE_GRACE_MS 10000
+
+#define TALK_LOG_FILE        "talk-log.csv"
+#define TALK_LOG_INTERVAL_MS 60000
+
 /* clang-format on */
 
+/* Where the filter gets the audio it analyses from */
+enum analysis_tap {
+    /* filter_audio, hears whatever the filters above it left */
+    TAP_FILTER,
+    /* The parent's audio capture callback, which obs calls with the output
+     * of the whole filter chain, wherever this filter is
+     */
+    TAP_OUTPUT,
+    TAP_COUNT,
+};
+
+/* Startup phases, these show up in obs' profiler tree when a scene collection is loaded */
+static const char *profile_create = "muted_create";
+static const char *profile_context = "muted_context_init";
+static const char *profile_module_load = "muted_module_load";
+
+/* Context init, sound decode and device open run here instead of on obs'
+ * loading thread, so a scene collection with many filters sets them up in
+ * parallel
+ */
+static struct task_pool *setup_pool = NULL;
+
+/* Every live filter, for the setup pool's poll. Filters leave it in destroy,
+ * before the reaper frees them
+ */
+static pthread_mutex_t filters_mutex;
+static DARRAY(struct muted_data *) filters;
+
 struct muted_data {
     obs_source_t *context;
-    char *file_path;
-    char *device;
-    bool ma_initialized;
-    ma_context ma_context;
-    ma_device_config ma_config;
-    ma_device ma_device;
-    ma_decoder ma_decoder;
-    ma_log ma_log;
-
-    float sample_rate_i;
-    size_t channels;
+    /* "filter source" prefix for miniaudio's log messages, which can come
+     * from any thread and after the source is gone. Replaced on renames,
+     * read inside a reaper section
+     */
+    char *volatile log_name;
+    struct playback playback;
 
-    float open_threshold;
-    float close_threshold;
-    float decay_rate;
-    float attack_rate;
-    float release_rate;
-    float hold_time;
-
-    bool is_open;
-    float attenuation;
-    float level;
-    float held_time;
-
-    uint64_t cooldown;
-    uint64_t last_play_time;
-    uint64_t file_length;
+    size_t channels;
+    struct detector detector;
+    /* Loop the sound for as long as the gate stays open, set by muted_update */
+    volatile bool continuous;
+    /* Start the device when the level gets close to opening the gate and stop
+     * it when idle, set by muted_update
+     */
+    volatile bool prewarm;
+    /* Also gate the audio like obs' noise gate, set by muted_update */
+    volatile bool gate;
+    /* enum analysis_tap, set by muted_update */
+    volatile long tap;
+    /* Whether the source counted as muted for the last analysed block, as the
+     * selected tap sees it. Written by the audio thread, read by the meter
+     */
+    volatile bool analysis_muted;
+    /* Time spent analysing per tap, audio thread only. Read in teardown,
+     * when neither the filter nor the capture callback can run anymore
+     */
+    uint64_t analysis_ns[TAP_COUNT];
+    uint64_t analysis_blocks[TAP_COUNT];
+    /* Audio thread only, when to ask the setup task to stop the idle device, 0 if not started */
+    uint64_t warm_until;
+    /* Set by the audio thread, which can't take locks, and turned into a
+     * setup task by the setup pool's poll, see request_setup
+     */
+    volatile bool prepare_requested;
+    volatile bool release_requested;
+    /* Public state for the talk log and the state query, NULL if the registry is full */
+    struct registry_slot *slot;
+    /* Source the filter is on, for following its name */
+    obs_source_t *parent;
+
+    /* Latest playback settings waiting for the setup task. At most one task
+     * per filter is queued or running, it keeps applying settings until none
+     * are left so updates stay in order and pile-ups collapse into one
+     */
+    pthread_mutex_t setup_mutex;
+    pthread_cond_t setup_cond;
+    struct playback_settings setup;
+    char *setup_path;
+    char *setup_device;
+    bool setup_pending;
+    /* The level is close to opening the gate, start the device */
+    bool setup_prepare;
+    /* The device may be idle, playback_release_idle decides */
+    bool setup_release;
+    bool setup_running;
+    bool setup_initialized;
+    /* Set once the playback context exists, until then there's nothing to play */
+    volatile bool ready;
 };
 
 OBS_DECLARE_MODULE()
@@ -88,16 +215,6 @@ OBS_DECLARE_MODULE()
 lookup_t *obs_filter_lookup = NULL;
 lookup_t *obs_module_lookup = NULL;
 
-/* Forwards lookups to the obs filter module which has the strings for the
- * noise-gate portion of this filter
- */
-const char *obs_module_text(const char *val)
-{
-    const char *out = val;
-    text_lookup_getstr(obs_filter_lookup, val, &out);
-    return out;
-}
-
 bool obs_module_get_string(const char *val, const char **out)
 {
     if (strstr(val, "NoiseGate") != NULL)
@@ -105,6 +222,16 @@ bool obs_module_get_string(const char *val, const char **out)
     return text_lookup_getstr(obs_module_lookup, val, out);
 }
 
+/* NoiseGate strings come from the obs filter module, which has them for the
+ * noise-gate portion of this filter, everything else from our own locale
+ */
+const char *obs_module_text(const char *val)
+{
+    const char *out = val;
+    obs_module_get_string(val, &out);
+    return out;
+}
+
 void obs_module_set_locale(const char *locale)
 {
     if (obs_filter_lookup)
@@ -124,317 +251,454 @@ void obs_module_free_locale(void)
 static void log_callback(void *ctx, ma_uint32 level, const char *message)
 {
     struct muted_data *data = ctx;
-    const char *filter_name = obs_source_get_name(data->context);
-    obs_source_t *parent = obs_filter_get_parent(data->context);
-    const char *filter_parent_name = "";
-    if (parent)
-        filter_parent_name = obs_source_get_name(parent);
+    long epoch = reaper_enter();
+    const char *name = atomic_ptr_load((void *volatile *)&data->log_name);
 
     switch (level) {
     case MA_LOG_LEVEL_INFO:
-        blog(LOG_DEBUG, "[%s %s] miniaudio: %s", filter_name, filter_parent_name, message);
+        blog(LOG_DEBUG, "[%s] miniaudio: %s", name, message);
         break;
     case MA_LOG_LEVEL_DEBUG:
-        blog(LOG_DEBUG, "[%s %s] miniaudio: %s", filter_name, filter_parent_name, message);
+        blog(LOG_DEBUG, "[%s] miniaudio: %s", name, message);
         break;
     case MA_LOG_LEVEL_WARNING:
-        blog(LOG_WARNING, "[%s %s] miniaudio: %s", filter_name, filter_parent_name, message);
+        blog(LOG_WARNING, "[%s] miniaudio: %s", name, message);
         break;
     case MA_LOG_LEVEL_ERROR:
-        blog(LOG_ERROR, "[%s %s] miniaudio: %s", filter_name, filter_parent_name, message);
+        blog(LOG_ERROR, "[%s] miniaudio: %s", name, message);
         break;
     }
+    reaper_exit(epoch);
+}
+
+/* Called on the UI thread whenever the filter or its source is renamed */
+static void update_log_name(struct muted_data *ng)
+{
+    struct dstr name = {0};
+    dstr_printf(&name, "%s %s", obs_source_get_name(ng->context), ng->parent ? obs_source_get_name(ng->parent) : "");
+    char *old = atomic_ptr_exchange((void *volatile *)&ng->log_name, name.array);
+    if (old)
+        reaper_retire(bfree, old);
+}
+
+static void add_device(void *param, const char *name)
+{
+    obs_property_list_add_string(param, name, name);
 }
 
 static void populate_list(struct muted_data *d, obs_property_t *list)
 {
-    ma_result result;
-    ma_device_info *playack_devices;
-    ma_uint32 playback_device_count;
     obs_property_list_clear(list);
 
-    result = ma_context_get_devices(&d->ma_context, &playack_devices, &playback_device_count, NULL, NULL);
-    if (result == MA_SUCCESS) {
-        for (ma_uint32 i = 0; i < playback_device_count; ++i) {
-            obs_property_list_add_string(list, playack_devices[i].name, playack_devices[i].name);
+    if (!os_atomic_load_bool(&d->ready))
+        return;
+
+    playback_enum_devices(&d->playback, add_device, list);
+}
+
+static const char *muted_name(void *unused)
+{
+    UNUSED_PARAMETER(unused);
+    return "Muted notification";
+}
+
+static void muted_setup_task(void *param)
+{
+    struct muted_data *ng = param;
+    struct playback_settings ps;
+    char *path, *device;
+
+    pthread_mutex_lock(&ng->setup_mutex);
+    while (ng->setup_pending || ng->setup_prepare || ng->setup_release) {
+        bool apply = ng->setup_pending;
+        bool prepare = ng->setup_prepare;
+        bool release = ng->setup_release;
+        ps = ng->setup;
+        path = ng->setup_path;
+        device = ng->setup_device;
+        ng->setup_path = NULL;
+        ng->setup_device = NULL;
+        ng->setup_pending = false;
+        ng->setup_prepare = false;
+        ng->setup_release = false;
+        pthread_mutex_unlock(&ng->setup_mutex);
+
+        if (apply && !ng->setup_initialized) {
+            profile_start(profile_context);
+            playback_init(&ng->playback, NULL, 0, &log_callback, ng);
+            profile_end(profile_context);
+            ng->setup_initialized = true;
+            os_atomic_set_bool(&ng->ready, true);
         }
-    } else {
-        blog(LOG_ERROR, "ma_context_get_devices failed");
+        if (apply)
+            playback_update(&ng->playback, &ps);
+        if (prepare && ng->setup_initialized)
+            playback_prepare(&ng->playback);
+        if (release && ng->setup_initialized)
+            playback_release_idle(&ng->playback, PREWARM_IDLE_MS);
+        bfree(path);
+        bfree(device);
+
+        pthread_mutex_lock(&ng->setup_mutex);
     }
+    ng->setup_running = false;
+    pthread_cond_broadcast(&ng->setup_cond);
+    pthread_mutex_unlock(&ng->setup_mutex);
 }
 
-static void play_audio(struct muted_data *data)
+static void muted_post_setup(struct muted_data *ng, const struct playback_settings *ps)
 {
-    ma_result result = ma_device_start(&data->ma_device);
-    ma_decoder_seek_to_pcm_frame(&data->ma_decoder, 0);
-    blog(LOG_DEBUG, "Playing audio");
-    if (result != MA_SUCCESS) {
-        blog(LOG_ERROR, "Failed to start playback.");
-    }
+    bool start;
+
+    pthread_mutex_lock(&ng->setup_mutex);
+    bfree(ng->setup_path);
+    bfree(ng->setup_device);
+    ng->setup = *ps;
+    ng->setup.path = ng->setup_path = bstrdup(ps->path);
+    ng->setup.device = ng->setup_device = bstrdup(ps->device);
+    ng->setup_pending = true;
+    start = !ng->setup_running;
+    ng->setup_running = true;
+    pthread_mutex_unlock(&ng->setup_mutex);
+
+    if (start)
+        task_pool_push(setup_pool, muted_setup_task, ng);
 }
 
-static const char *muted_name(void *unused)
+/* Runs on the setup pool's poll thread, holding filters_mutex */
+static void muted_post_requests(struct muted_data *ng, bool prepare, bool release)
+{
+    bool start;
+
+    pthread_mutex_lock(&ng->setup_mutex);
+    ng->setup_prepare |= prepare;
+    ng->setup_release |= release;
+    start = !ng->setup_running;
+    ng->setup_running = true;
+    pthread_mutex_unlock(&ng->setup_mutex);
+
+    if (start)
+        task_pool_push(setup_pool, muted_setup_task, ng);
+}
+
+static void poll_requests(void *unused)
 {
     UNUSED_PARAMETER(unused);
-    return "Muted notification";
+
+    pthread_mutex_lock(&filters_mutex);
+    for (size_t i = 0; i < filters.num; i++) {
+        struct muted_data *ng = filters.array[i];
+        bool prepare = os_atomic_set_bool(&ng->prepare_requested, false);
+        bool release = os_atomic_set_bool(&ng->release_requested, false);
+        if (prepare || release)
+            muted_post_requests(ng, prepare, release);
+    }
+    pthread_mutex_unlock(&filters_mutex);
 }
 
-static void free_device(struct muted_data *d)
+static void parent_renamed(void *data, calldata_t *cd)
 {
-    ma_device_uninit(&d->ma_device);
-    bfree(d->device);
-    d->device = NULL;
-    memset(&d->ma_config, 0, sizeof(ma_device_config));
+    struct muted_data *ng = data;
+    registry_set_name(ng->slot, calldata_string(cd, "new_name"));
+    update_log_name(ng);
 }
 
-static void free_wav(struct muted_data *d)
+static void filter_renamed(void *data, calldata_t *cd)
 {
-    ma_decoder_uninit(&d->ma_decoder);
-    bfree(d->file_path);
-    d->file_path = NULL;
+    UNUSED_PARAMETER(cd);
+    update_log_name(data);
 }
 
-static void muted_destroy(void *data)
+static void capture_audio(void *data, obs_source_t *source, const struct audio_data *audio, bool muted);
+
+static void muted_filter_add(void *data, obs_source_t *source)
 {
     struct muted_data *ng = data;
-    free_wav(data);
-    free_device(data);
-    ma_context_uninit(&ng->ma_context);
-    ma_log_uninit(&ng->ma_log);
-    bfree(ng->file_path);
-    bfree(ng->device);
-    bfree(ng);
+    ng->parent = source;
+    registry_set_name(ng->slot, obs_source_get_name(source));
+    update_log_name(ng);
+    signal_handler_connect(obs_source_get_signal_handler(source), "rename", parent_renamed, ng);
+    /* Always registered, it returns right away unless the tap is selected */
+    obs_source_add_audio_capture_callback(source, capture_audio, ng);
 }
 
-static inline float ms_to_secf(int ms)
+static void muted_filter_remove(void *data, obs_source_t *source)
 {
-    return (float)ms / 1000.0f;
+    struct muted_data *ng = data;
+    /* Waits for a running callback, obs calls them under its own lock */
+    obs_source_remove_audio_capture_callback(source, capture_audio, ng);
+    signal_handler_disconnect(obs_source_get_signal_handler(source), "rename", parent_renamed, ng);
+    ng->parent = NULL;
 }
 
-static void load_wav(struct muted_data *d, const char *path)
+/* How much pre-warming saved, a warm start only waits for the next callback,
+ * and the scheduling the playback thread ended up with, which explains slow
+ * starts when real time priority or pinning was refused
+ */
+static void log_start_latency(struct muted_data *ng)
 {
-    ma_result result = ma_decoder_init_file(path, NULL, &d->ma_decoder);
-    if (result == MA_SUCCESS) {
-        bfree(d->file_path);
-        d->file_path = bstrdup(path);
+    struct playback_stats stats;
+    struct dstr thread = {0};
 
-        ma_uint64 frameCount;
-        result = ma_decoder_get_length_in_pcm_frames(&d->ma_decoder, &frameCount);
-        if (result == MA_SUCCESS) {
-            d->file_length = (frameCount / d->ma_decoder.outputSampleRate) * 1000;
-            blog(LOG_DEBUG, "'%s' is %i ms long", path, (int)d->file_length); // macos won't use %llu so screw it
-        } else {
-            blog(LOG_ERROR, "ma_decoder_get_length_in_pcm_frames failed for '%s'", path);
-        }
+    playback_get_stats(&ng->playback, &stats);
+    if (!stats.warm_starts && !stats.cold_starts)
+        return;
 
-    } else {
-        blog(LOG_ERROR, "Failed to open '%s'", path);
-    }
+    if (stats.thread_known)
+        dstr_printf(&thread, ", thread %s priority %d affinity 0x%llx%s%s", stats.thread.policy,
+                    stats.thread.priority, (unsigned long long)stats.thread.affinity,
+                    stats.realtime_denied ? " (real time denied)" : "",
+                    stats.affinity_denied ? " (affinity denied)" : "");
+
+    blog(stats.realtime_denied || stats.affinity_denied ? LOG_WARNING : LOG_INFO,
+         "[%s] Start latency: %u warm (%.1f ms), %u cold (%.1f ms), %u prepared, %u released, %u stolen, %u dropped%s",
+         ng->log_name, stats.warm_starts, stats.warm_latency_ms, stats.cold_starts, stats.cold_latency_ms,
+         stats.prepares, stats.releases, stats.steals, stats.dropped, thread.array ? thread.array : "");
+    dstr_free(&thread);
 }
 
-static void playback_cb(ma_device *dev, void *output, const void *input, ma_uint32 frame_count)
+/* Cpu the analysis took at each tap, so they can be compared on a real setup */
+static void log_analysis_cost(struct muted_data *ng)
 {
-    UNUSED_PARAMETER(input);
-    struct muted_data *data = dev->pUserData;
-    ma_uint64 read = 0;
-    while (frame_count > 0) {
-        ma_result res = ma_decoder_read_pcm_frames(&data->ma_decoder, output, frame_count, &read);
-        if (res != MA_SUCCESS) {
-            if (res == MA_AT_END) {
-                break;
-            }
-            blog(LOG_ERROR, "Error in playback callback");
-            break;
-        }
-        frame_count -= (ma_uint32)read;
+    const char *names[TAP_COUNT] = {"filter", "source output"};
+
+    for (size_t i = 0; i < TAP_COUNT; i++) {
+        if (!ng->analysis_blocks[i])
+            continue;
+        blog(LOG_INFO, "[%s] Analysis at the %s: %llu blocks, %.1f us per block", ng->log_name, names[i],
+             (unsigned long long)ng->analysis_blocks[i],
+             (double)ng->analysis_ns[i] / 1000.0 / (double)ng->analysis_blocks[i]);
     }
 }
 
-static void open_device(struct muted_data *d, const char *device)
+/* Runs on the reaper thread. Nothing refers to the source anymore, the
+ * setup task and the device thread are the only ones left using the filter
+ */
+static void muted_teardown(void *data)
 {
-    ma_device_info *pPlaybackDevices;
-    ma_uint32 playbackDeviceCount;
-    ma_result result = ma_context_get_devices(&d->ma_context, &pPlaybackDevices, &playbackDeviceCount, NULL, NULL);
-    ma_device_config deviceConfig;
-    ma_device_info *pPlaybackDevice = NULL;
-
-    if (result != MA_SUCCESS) {
-        blog(LOG_ERROR, "Failed to enumerate audio devices.");
-        return;
-    }
+    struct muted_data *ng = data;
 
-    // Find the device with the specified name
-    for (ma_uint32 i = 0; i < playbackDeviceCount; ++i) {
-        if (strcmp(pPlaybackDevices[i].name, device) == 0) {
-            pPlaybackDevice = &pPlaybackDevices[i];
-            break;
-        }
+    /* The current step finishes, nothing new was queued since destroy */
+    pthread_mutex_lock(&ng->setup_mutex);
+    while (ng->setup_running)
+        pthread_cond_wait(&ng->setup_cond, &ng->setup_mutex);
+    pthread_mutex_unlock(&ng->setup_mutex);
+
+    log_analysis_cost(ng);
+    /* Stops the device thread, the last one that could call back */
+    if (ng->setup_initialized) {
+        log_start_latency(ng);
+        playback_free(&ng->playback);
     }
+    detector_free(&ng->detector);
+    pthread_cond_destroy(&ng->setup_cond);
+    pthread_mutex_destroy(&ng->setup_mutex);
+    bfree(ng->setup_path);
+    bfree(ng->setup_device);
+    bfree(ng->log_name);
+    bfree(ng);
+}
 
-    if (pPlaybackDevice == NULL) {
-        blog(LOG_ERROR, "Failed to find playback device with name '%s'", device);
-        return;
-    }
+static void muted_destroy(void *data)
+{
+    struct muted_data *ng = data;
 
-    // open device using the info in ma_device_info
-    deviceConfig = ma_device_config_init(ma_device_type_playback);
-    deviceConfig.playback.format = d->ma_decoder.outputFormat;
-    deviceConfig.playback.channels = d->ma_decoder.outputChannels;
-    deviceConfig.sampleRate = d->ma_decoder.outputSampleRate;
-    deviceConfig.dataCallback = playback_cb;
-    deviceConfig.pUserData = d;
-    deviceConfig.playback.pDeviceID = &pPlaybackDevice->id;
-
-    result = ma_device_init(&d->ma_context, &deviceConfig, &d->ma_device);
-
-    if (result == MA_SUCCESS) {
-        blog(LOG_INFO, "Opened '%s'", device);
-        bfree(d->device);
-        d->device = bstrdup(device);
-    } else {
-        blog(LOG_ERROR, "Failed to open playback device '%s'", device);
-    }
+    pthread_mutex_lock(&filters_mutex);
+    da_erase_item(filters, &ng);
+    pthread_mutex_unlock(&filters_mutex);
+
+    if (ng->parent)
+        muted_filter_remove(ng, ng->parent);
+    signal_handler_disconnect(obs_source_get_signal_handler(ng->context), "rename", filter_renamed, ng);
+    talk_log_retire(ng->slot);
+    registry_release(ng->slot);
+
+    /* Settings that haven't been applied yet are dropped, stopping the device
+     * and freeing everything happens in the background so removing many
+     * filters at once doesn't stall the UI
+     */
+    pthread_mutex_lock(&ng->setup_mutex);
+    ng->setup_pending = false;
+    ng->setup_prepare = false;
+    ng->setup_release = false;
+    pthread_mutex_unlock(&ng->setup_mutex);
+
+    reaper_retire(muted_teardown, ng);
 }
 
 static void muted_update(void *data, obs_data_t *s)
 {
     struct muted_data *ng = data;
-    float open_threshold_db;
-    float close_threshold_db;
+    struct detector_settings ds;
+    struct playback_settings ps;
     float sample_rate;
-    int attack_time_ms;
-    int hold_time_ms;
-    int release_time_ms;
-    const char *device;
-    const char *path;
-
-    path = obs_data_get_string(s, S_FILE);
-    device = obs_data_get_string(s, S_DEVICE);
-
-    open_threshold_db = (float)obs_data_get_double(s, S_OPEN_THRESHOLD);
-    close_threshold_db = (float)obs_data_get_double(s, S_CLOSE_THRESHOLD);
-    attack_time_ms = (int)obs_data_get_int(s, S_ATTACK_TIME);
-    hold_time_ms = (int)obs_data_get_int(s, S_HOLD_TIME);
-    release_time_ms = (int)obs_data_get_int(s, S_RELEASE_TIME);
-    sample_rate = (float)audio_output_get_sample_rate(obs_get_audio());
-
-    ng->cooldown = (int)obs_data_get_int(s, S_COOLDOWN);
 
-    ng->sample_rate_i = 1.0f / sample_rate;
-    ng->channels = audio_output_get_channels(obs_get_audio());
-    ng->open_threshold = db_to_mul(open_threshold_db);
-    ng->close_threshold = db_to_mul(close_threshold_db);
-    ng->attack_rate = 1.0f / (ms_to_secf(attack_time_ms) * sample_rate);
-    ng->release_rate = 1.0f / (ms_to_secf(release_time_ms) * sample_rate);
-
-    const float threshold_diff = ng->open_threshold - ng->close_threshold;
-    const float min_decay_period = (1.0f / 75.0f) * sample_rate;
-
-    ng->decay_rate = threshold_diff / min_decay_period;
-    ng->hold_time = ms_to_secf(hold_time_ms);
-    ng->is_open = false;
-    ng->attenuation = 0.0f;
-    ng->level = 0.0f;
-    ng->held_time = 0.0f;
-
-    if (!ng->file_path || strcmp(path, ng->file_path) != 0) {
-        free_wav(data);
-        load_wav(data, path);
-        free_device(ng);
-        open_device(data, device);
+    ps.path = obs_data_get_string(s, S_FILE);
+    ps.device = obs_data_get_string(s, S_DEVICE);
+    ps.compact = obs_data_get_bool(s, S_COMPACT);
+    ps.thread_priority = (ma_thread_priority)obs_data_get_int(s, S_PRIORITY);
+    if (!thread_parse_affinity(obs_data_get_string(s, S_AFFINITY), &ps.affinity)) {
+        blog(LOG_WARNING, "Ignoring invalid cpu list '%s'", obs_data_get_string(s, S_AFFINITY));
+        ps.affinity = 0;
     }
 
-    if (!ng->device || strcmp(device, ng->device) != 0) {
-        free_device(ng);
-        open_device(data, device);
-    }
+    ds.open_threshold_db = (float)obs_data_get_double(s, S_OPEN_THRESHOLD);
+    ds.close_threshold_db = (float)obs_data_get_double(s, S_CLOSE_THRESHOLD);
+    ds.attack_time_ms = (int)obs_data_get_int(s, S_ATTACK_TIME);
+    ds.hold_time_ms = (int)obs_data_get_int(s, S_HOLD_TIME);
+    ds.release_time_ms = (int)obs_data_get_int(s, S_RELEASE_TIME);
+    ds.cooldown_ms = (int)obs_data_get_int(s, S_COOLDOWN);
+    ds.scan_stride = obs_data_get_bool(s, S_SPARSE_SCAN) ? SPARSE_SCAN_STRIDE : 0;
+    ds.lookahead_blocks = (int)obs_data_get_int(s, S_LOOKAHEAD);
+    os_atomic_set_bool(&ng->continuous, obs_data_get_bool(s, S_CONTINUOUS));
+    os_atomic_set_bool(&ng->prewarm, obs_data_get_bool(s, S_PREWARM));
+    os_atomic_set_bool(&ng->gate, obs_data_get_bool(s, S_GATE));
+    os_atomic_set_long(&ng->tap, (long)obs_data_get_int(s, S_TAP));
+    sample_rate = (float)audio_output_get_sample_rate(obs_get_audio());
+
+    detector_post_update(&ng->detector, &ds, sample_rate);
+
+    muted_post_setup(ng, &ps);
 }
 
 static void *muted_create(obs_data_t *settings, obs_source_t *filter)
 {
     struct muted_data *ng = bzalloc(sizeof(*ng));
     ng->context = filter;
-    ma_context_config cfg = ma_context_config_init();
-    ma_log_callback cb = ma_log_callback_init(&log_callback, ng);
-
-    if (ma_log_init(NULL, &ng->ma_log) != MA_SUCCESS) {
-        blog(LOG_ERROR, "Failed to init ma_log");
-        goto end;
-    }
-
-    if (ma_log_register_callback(&ng->ma_log, cb) != MA_SUCCESS) {
-        blog(LOG_ERROR, "Failed to register log callback");
-        goto end;
-    }
+    update_log_name(ng);
+    signal_handler_connect(obs_source_get_signal_handler(filter), "rename", filter_renamed, ng);
+    ng->channels = audio_output_get_channels(obs_get_audio());
+    detector_init(&ng->detector);
+    pthread_mutex_init(&ng->setup_mutex, NULL);
+    pthread_cond_init(&ng->setup_cond, NULL);
+    ng->slot = registry_acquire(audio_output_get_sample_rate(obs_get_audio()));
+
+    /* Only queues the expensive part, the filter starts playing once its
+     * setup task has run
+     */
+    profile_start(profile_create);
+    muted_update(ng, settings);
+    profile_end(profile_create);
+
+    pthread_mutex_lock(&filters_mutex);
+    da_push_back(filters, &ng);
+    pthread_mutex_unlock(&filters_mutex);
+    return ng;
+}
 
-    cfg.pUserData = ng;
-    cfg.pLog = &ng->ma_log;
+static inline uint64_t now_ms(void)
+{
+    return (uint64_t)(os_gettime_ns() / ((uint64_t)1e6));
+}
 
-    if (ma_context_init(NULL, 0, &cfg, &ng->ma_context) != MA_SUCCESS) {
-        blog(LOG_ERROR, "Failed to initialize context.");
-    } else {
-        ng->ma_initialized = true;
-        muted_update(ng, settings);
-    }
+/* Audio thread, wakes the poll only when the flag wasn't already up */
+static inline void request_setup(volatile bool *requested)
+{
+    if (!os_atomic_set_bool(requested, true))
+        task_pool_wake_poll(setup_pool);
+}
 
-end:
-    return ng;
+/* Hands the device back once nothing was prepared or played for a while,
+ * the stop itself runs on the setup task
+ */
+static void release_if_idle(struct muted_data *ng, uint64_t time)
+{
+    if (!ng->warm_until || time < ng->warm_until || playback_is_playing(&ng->playback))
+        return;
+    if (os_atomic_load_bool(&ng->prewarm))
+        request_setup(&ng->release_requested);
+    ng->warm_until = 0;
 }
 
-static struct obs_audio_data *muted_filter_audio(void *data, struct obs_audio_data *audio)
+/* Detection and triggering for one block of whichever tap is selected */
+static void analyze_block(struct muted_data *ng, float **planes, uint32_t frames, bool muted, bool gate)
 {
-    struct muted_data *ng = data;
-    obs_source_t *parent = obs_filter_get_parent(ng->context);
-    if (!obs_source_muted(parent)) {
-        ng->is_open = false;
-        return audio;
-    }
+    uint64_t time = now_ms();
 
-    float **adata = (float **)audio->data;
-    const float close_threshold = ng->close_threshold;
-    const float open_threshold = ng->open_threshold;
-    const float sample_rate_i = ng->sample_rate_i;
-    const float release_rate = ng->release_rate;
-    const float attack_rate = ng->attack_rate;
-    const float decay_rate = ng->decay_rate;
-    const float hold_time = ng->hold_time;
-    const size_t channels = ng->channels;
-
-    for (size_t i = 0; i < audio->frames; i++) {
-        float cur_level = fabsf(adata[0][i]);
-        for (size_t j = 0; j < channels; j++) {
-            cur_level = fmaxf(cur_level, fabsf(adata[j][i]));
+    os_atomic_set_bool(&ng->analysis_muted, muted);
+    if (!muted) {
+        /* As a noise gate the envelope keeps running, it's what others hear */
+        if (gate) {
+            detector_process_gate(&ng->detector, planes, ng->channels, frames);
+        } else {
+            ng->detector.is_open = false;
+            detector_reset_lookahead(&ng->detector);
         }
+        playback_set_looping(&ng->playback, false);
+        release_if_idle(ng, time);
+        if (ng->slot)
+            registry_publish(ng->slot, frames, false, false, 0);
+        return;
+    }
 
-        if (cur_level > open_threshold && !ng->is_open) {
-            ng->is_open = true;
-        }
-        if (ng->level < close_threshold && ng->is_open) {
-            ng->held_time = 0.0f;
-            ng->is_open = false;
+    bool open = gate ? detector_process_gate(&ng->detector, planes, ng->channels, frames)
+                     : detector_process(&ng->detector, planes, ng->channels, frames);
+    bool triggered = false;
+
+    if (os_atomic_load_bool(&ng->ready)) {
+        /* The level is past the close threshold, most of the device start
+         * happens now instead of after the gate opened. Starting a device
+         * can block, the setup task does it
+         */
+        if (ng->detector.approaching && os_atomic_load_bool(&ng->prewarm)) {
+            request_setup(&ng->prepare_requested);
+            ng->warm_until = time + PREWARM_IDLE_MS;
         }
 
-        ng->level = fmaxf(ng->level, cur_level) - decay_rate;
-
-        if (ng->is_open) {
-            ng->attenuation = fminf(1.0f, ng->attenuation + attack_rate);
-        } else {
-            ng->held_time += sample_rate_i;
-            if (ng->held_time > hold_time) {
-                ng->attenuation = fmaxf(0.0f, ng->attenuation - release_rate);
+        /* In continuous mode a sound that is still playing just keeps
+         * looping, only a new start counts as a notification
+         */
+        bool continuous = os_atomic_load_bool(&ng->continuous);
+        playback_set_looping(&ng->playback, continuous && open);
+        if (!continuous || !playback_is_playing(&ng->playback)) {
+            triggered = detector_check_trigger(&ng->detector, time, playback_file_length(&ng->playback));
+            if (triggered) {
+                playback_play(&ng->playback);
+                ng->warm_until = time + PREWARM_IDLE_MS;
             }
         }
+        release_if_idle(ng, time);
     }
 
-    uint64_t time = (uint64_t)(os_gettime_ns() / ((uint64_t)1e6));
-    if (ng->is_open && (time - ng->last_play_time) > (ng->file_length + ng->cooldown)) {
-        ng->last_play_time = time;
-        play_audio(data);
-    }
+    if (ng->slot)
+        registry_publish(ng->slot, frames, open, triggered, time);
+}
+
+static struct obs_audio_data *muted_filter_audio(void *data, struct obs_audio_data *audio)
+{
+    struct muted_data *ng = data;
 
+    if (os_atomic_load_long(&ng->tap) != TAP_FILTER)
+        return audio;
+
+    uint64_t start = os_gettime_ns();
+    obs_source_t *parent = obs_filter_get_parent(ng->context);
+    analyze_block(ng, (float **)audio->data, audio->frames, obs_source_muted(parent), os_atomic_load_bool(&ng->gate));
+    ng->analysis_ns[TAP_FILTER] += os_gettime_ns() - start;
+    ng->analysis_blocks[TAP_FILTER]++;
     return audio;
 }
 
+/* Called by obs on the same thread as the filter chain, right after it. muted
+ * also covers push to talk and push to mute
+ */
+static void capture_audio(void *data, obs_source_t *source, const struct audio_data *audio, bool muted)
+{
+    UNUSED_PARAMETER(source);
+    struct muted_data *ng = data;
+
+    if (os_atomic_load_long(&ng->tap) != TAP_OUTPUT)
+        return;
+
+    /* The audio is read only here, gating needs the filter's position and
+     * its option is hidden while this tap is selected
+     */
+    uint64_t start = os_gettime_ns();
+    analyze_block(ng, (float **)audio->data, audio->frames, muted, false);
+    ng->analysis_ns[TAP_OUTPUT] += os_gettime_ns() - start;
+    ng->analysis_blocks[TAP_OUTPUT]++;
+}
+
 static void muted_defaults(obs_data_t *s)
 {
     obs_data_set_default_double(s, S_OPEN_THRESHOLD, -26.0);
@@ -443,10 +707,67 @@ static void muted_defaults(obs_data_t *s)
     obs_data_set_default_int(s, S_HOLD_TIME, 200);
     obs_data_set_default_int(s, S_RELEASE_TIME, 150);
     obs_data_set_default_int(s, S_COOLDOWN, 1500);
+    obs_data_set_default_bool(s, S_SPARSE_SCAN, false);
+    obs_data_set_default_bool(s, S_CONTINUOUS, false);
+    obs_data_set_default_bool(s, S_PREWARM, false);
+    obs_data_set_default_bool(s, S_GATE, false);
+    obs_data_set_default_int(s, S_LOOKAHEAD, 0);
+    obs_data_set_default_int(s, S_TAP, TAP_FILTER);
     obs_data_set_default_int(s, S_DEVICE, 0);
-    char *path = obs_module_file("urmuted.wav");
-    obs_data_set_default_string(s, S_FILE, path);
-    bfree(path);
+    /* Empty selects the built-in sound, no file access needed */
+    obs_data_set_default_string(s, S_FILE, "");
+    obs_data_set_default_bool(s, S_COMPACT, false);
+    obs_data_set_default_int(s, S_PRIORITY, ma_thread_priority_default);
+    obs_data_set_default_string(s, S_AFFINITY, "");
+}
+
+/* Only reads what the audio thread published for the last block, properties
+ * don't update on their own so this runs when they're created and on refresh
+ */
+static void update_meter(struct muted_data *ng, obs_property_t *meter)
+{
+    struct detector_meter m;
+    char since[32];
+    struct dstr text = {0};
+
+    /* Same test the analysis used, so push to talk/mute count with the output tap */
+    if (!ng->parent || !os_atomic_load_bool(&ng->analysis_muted)) {
+        obs_property_set_description(meter, TEXT_METER_NOT_MUTED);
+        return;
+    }
+
+    detector_get_meter(&ng->detector, now_ms(), &m);
+    if (m.has_triggered)
+        snprintf(since, sizeof(since), "%.1f s", (double)m.since_trigger_ms / 1000.0);
+    else
+        snprintf(since, sizeof(since), "%s", TEXT_METER_NEVER);
+
+    dstr_printf(&text, "%s: %.1f dB, %s: %s, %s: %s", TEXT_METER_LEVEL, m.peak_db, TEXT_METER_GATE,
+                m.is_open ? TEXT_METER_OPEN : TEXT_METER_CLOSED, TEXT_METER_LAST, since);
+    obs_property_set_description(meter, text.array);
+    dstr_free(&text);
+}
+
+/* The file loads on the setup task, so a refresh may be needed to see it failed */
+static void update_file_status(struct muted_data *ng, obs_property_t *status)
+{
+    obs_property_set_visible(status, playback_clip_failed(&ng->playback));
+}
+
+static bool refresh_meter(obs_properties_t *props, obs_property_t *property, void *data)
+{
+    UNUSED_PARAMETER(property);
+    update_meter(data, obs_properties_get(props, S_METER));
+    update_file_status(data, obs_properties_get(props, S_FILE_STATUS));
+    return true;
+}
+
+/* Gating needs the filter's position, the output tap can't change the audio */
+static bool tap_modified(obs_properties_t *props, obs_property_t *property, obs_data_t *settings)
+{
+    UNUSED_PARAMETER(property);
+    obs_property_set_visible(obs_properties_get(props, S_GATE), obs_data_get_int(settings, S_TAP) == TAP_FILTER);
+    return true;
 }
 
 static obs_properties_t *muted_properties(void *data)
@@ -455,6 +776,10 @@ static obs_properties_t *muted_properties(void *data)
     obs_property_t *p;
     struct muted_data *d = data;
 
+    p = obs_properties_add_text(ppts, S_METER, "", OBS_TEXT_INFO);
+    update_meter(d, p);
+    obs_properties_add_button(ppts, S_METER_REFRESH, TEXT_METER_REFRESH, refresh_meter);
+
     p = obs_properties_add_float_slider(ppts, S_CLOSE_THRESHOLD, TEXT_CLOSE_THRESHOLD, VOL_MIN, VOL_MAX, 1.0);
     obs_property_float_set_suffix(p, " dB");
     p = obs_properties_add_float_slider(ppts, S_OPEN_THRESHOLD, TEXT_OPEN_THRESHOLD, VOL_MIN, VOL_MAX, 1.0);
@@ -467,13 +792,43 @@ static obs_properties_t *muted_properties(void *data)
     obs_property_int_set_suffix(p, " ms");
     p = obs_properties_add_int(ppts, S_COOLDOWN, TEXT_COOLDOWN, 0, 10000, 500);
     obs_property_int_set_suffix(p, " ms");
+    p = obs_properties_add_int_slider(ppts, S_LOOKAHEAD, TEXT_LOOKAHEAD, 0, DETECTOR_MAX_LOOKAHEAD, 1);
+    obs_property_set_long_description(p, TEXT_LOOKAHEAD_TOOLTIP);
+    p = obs_properties_add_list(ppts, S_TAP, TEXT_TAP, OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+    obs_property_list_add_int(p, TEXT_TAP_FILTER, TAP_FILTER);
+    obs_property_list_add_int(p, TEXT_TAP_OUTPUT, TAP_OUTPUT);
+    obs_property_set_long_description(p, TEXT_TAP_TOOLTIP);
+    obs_property_set_modified_callback(p, tap_modified);
+    p = obs_properties_add_bool(ppts, S_GATE, TEXT_GATE);
+    obs_property_set_long_description(p, TEXT_GATE_TOOLTIP);
+    p = obs_properties_add_bool(ppts, S_CONTINUOUS, TEXT_CONTINUOUS);
+    obs_property_set_long_description(p, TEXT_CONTINUOUS_TOOLTIP);
+    p = obs_properties_add_bool(ppts, S_PREWARM, TEXT_PREWARM);
+    obs_property_set_long_description(p, TEXT_PREWARM_TOOLTIP);
+    p = obs_properties_add_bool(ppts, S_SPARSE_SCAN, TEXT_SPARSE_SCAN);
+    obs_property_set_long_description(p, TEXT_SPARSE_SCAN_TOOLTIP);
 
     p = obs_properties_add_list(ppts, S_DEVICE, TEXT_DEVICE, OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
     populate_list(d, p);
 
     char *path = obs_module_file("urmuted.wav");
-    obs_properties_add_path(ppts, S_FILE, TEXT_FILE, OBS_PATH_FILE, "WAV file (*.wav)", path);
+    p = obs_properties_add_path(ppts, S_FILE, TEXT_FILE, OBS_PATH_FILE, "WAV file (*.wav)", path);
+    obs_property_set_long_description(p, TEXT_FILE_TOOLTIP);
     bfree(path);
+    p = obs_properties_add_text(ppts, S_FILE_STATUS, TEXT_FILE_FAILED, OBS_TEXT_INFO);
+    obs_property_text_set_info_type(p, OBS_TEXT_INFO_WARNING);
+    update_file_status(d, p);
+    p = obs_properties_add_bool(ppts, S_COMPACT, TEXT_COMPACT);
+    obs_property_set_long_description(p, TEXT_COMPACT_TOOLTIP);
+
+    p = obs_properties_add_list(ppts, S_PRIORITY, TEXT_PRIORITY, OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+    obs_property_list_add_int(p, TEXT_PRIORITY_NORMAL, ma_thread_priority_normal);
+    obs_property_list_add_int(p, TEXT_PRIORITY_HIGH, ma_thread_priority_high);
+    obs_property_list_add_int(p, TEXT_PRIORITY_HIGHEST, ma_thread_priority_highest);
+    obs_property_list_add_int(p, TEXT_PRIORITY_REALTIME, ma_thread_priority_realtime);
+    obs_property_set_long_description(p, TEXT_PRIORITY_TOOLTIP);
+    p = obs_properties_add_text(ppts, S_AFFINITY, TEXT_AFFINITY, OBS_TEXT_DEFAULT);
+    obs_property_set_long_description(p, TEXT_AFFINITY_TOOLTIP);
 
     return ppts;
 }
@@ -487,6 +842,8 @@ struct obs_source_info muted_filter = {
     .destroy = muted_destroy,
     .update = muted_update,
     .filter_audio = muted_filter_audio,
+    .filter_add = muted_filter_add,
+    .filter_remove = muted_filter_remove,
     .get_defaults = muted_defaults,
     .get_properties = muted_properties,
 };
@@ -505,7 +862,25 @@ const char *obs_module_description(void)
 
 bool obs_module_load(void)
 {
+    profile_start(profile_module_load);
+    setup_pool = task_pool_create(0, "muted-notification setup");
+    pthread_mutex_init(&filters_mutex, NULL);
+    da_init(filters);
+    task_pool_set_poll(setup_pool, poll_requests, NULL);
+    recycle_start(RECYCLE_GRACE_MS);
+    reaper_start();
+
+    char *dir = obs_module_config_path("");
+    char *log_path = obs_module_config_path(TALK_LOG_FILE);
+    os_mkdirs(dir);
+    registry_init();
+    talk_log_start(log_path, TALK_LOG_INTERVAL_MS);
+    state_query_register();
+    bfree(log_path);
+    bfree(dir);
+
     obs_register_source(&muted_filter);
+    profile_end(profile_module_load);
     blog(LOG_INFO, "plugin loaded successfully (version %s)", PLUGIN_VERSION);
 
     return true;
@@ -513,6 +888,18 @@ bool obs_module_load(void)
 
 void obs_module_unload()
 {
+    /* All filters are destroyed by now, but their teardown may still be
+     * waiting on a setup task. The reaper finishes it before the pool goes
+     */
+    reaper_stop();
+    task_pool_destroy(setup_pool);
+    setup_pool = NULL;
+    da_free(filters);
+    pthread_mutex_destroy(&filters_mutex);
+    recycle_stop();
+    talk_log_stop();
+    state_query_unregister();
+    registry_free();
     text_lookup_destroy(obs_filter_lookup);
     text_lookup_destroy(obs_module_lookup);
 }
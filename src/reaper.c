@@ -0,0 +1,148 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <util/base.h>
+#include <util/bmem.h>
+#include <util/darray.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#include "reaper.h"
+#include "plugin-macros.generated.h"
+
+struct retired {
+    reaper_fn fn;
+    void *param;
+};
+
+static struct {
+    /* Readers count themselves in the slot of the epoch they entered in */
+    volatile long epoch;
+    volatile long readers[2];
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    DARRAY(struct retired) retired;
+    pthread_t thread;
+    bool running;
+    bool stopping;
+} reaper;
+
+long reaper_enter(void)
+{
+    for (;;) {
+        long epoch = os_atomic_load_long(&reaper.epoch);
+        os_atomic_inc_long(&reaper.readers[epoch & 1]);
+        /* If the epoch moved on in between, the reaper may already have
+         * seen the old slot empty, so count in the new one instead
+         */
+        if (os_atomic_load_long(&reaper.epoch) == epoch)
+            return epoch;
+        os_atomic_dec_long(&reaper.readers[epoch & 1]);
+    }
+}
+
+void reaper_exit(long epoch)
+{
+    os_atomic_dec_long(&reaper.readers[epoch & 1]);
+}
+
+/* Readers entering from now on count in the other slot, so once the old one
+ * drains nobody can still hold anything retired before the switch. The slot
+ * before that was drained by the last call, so calls must not overlap: it's
+ * only called by the reaper thread, or by retiring threads if it never started
+ */
+static void wait_for_readers(void)
+{
+    long old = os_atomic_inc_long(&reaper.epoch) - 1;
+    while (os_atomic_load_long(&reaper.readers[old & 1]))
+        os_sleep_ms(1);
+}
+
+static void *reaper_thread(void *unused)
+{
+    UNUSED_PARAMETER(unused);
+    DARRAY(struct retired) batch;
+
+    os_set_thread_name("muted-notification reaper");
+    da_init(batch);
+
+    pthread_mutex_lock(&reaper.mutex);
+    for (;;) {
+        while (!reaper.retired.num && !reaper.stopping)
+            pthread_cond_wait(&reaper.cond, &reaper.mutex);
+        if (!reaper.retired.num)
+            break;
+
+        /* Swapped out, so retiring never waits on a running free */
+        da_move(batch, reaper.retired);
+        pthread_mutex_unlock(&reaper.mutex);
+
+        wait_for_readers();
+        for (size_t i = 0; i < batch.num; i++)
+            batch.array[i].fn(batch.array[i].param);
+        da_free(batch);
+
+        pthread_mutex_lock(&reaper.mutex);
+    }
+    pthread_mutex_unlock(&reaper.mutex);
+    return NULL;
+}
+
+void reaper_start(void)
+{
+    pthread_mutex_init(&reaper.mutex, NULL);
+    pthread_cond_init(&reaper.cond, NULL);
+    da_init(reaper.retired);
+    reaper.stopping = false;
+    reaper.running = pthread_create(&reaper.thread, NULL, reaper_thread, NULL) == 0;
+    if (!reaper.running)
+        blog(LOG_WARNING, "Failed to start the reaper thread, resources are freed on the calling thread");
+}
+
+void reaper_stop(void)
+{
+    pthread_mutex_lock(&reaper.mutex);
+    reaper.stopping = true;
+    pthread_cond_signal(&reaper.cond);
+    pthread_mutex_unlock(&reaper.mutex);
+
+    if (reaper.running)
+        pthread_join(reaper.thread, NULL);
+    reaper.running = false;
+
+    da_free(reaper.retired);
+    pthread_cond_destroy(&reaper.cond);
+    pthread_mutex_destroy(&reaper.mutex);
+}
+
+void reaper_retire(reaper_fn fn, void *param)
+{
+    struct retired item = {fn, param};
+
+    if (!reaper.running) {
+        wait_for_readers();
+        fn(param);
+        return;
+    }
+
+    pthread_mutex_lock(&reaper.mutex);
+    da_push_back(reaper.retired, &item);
+    pthread_cond_signal(&reaper.cond);
+    pthread_mutex_unlock(&reaper.mutex);
+}
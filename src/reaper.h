@@ -0,0 +1,44 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+/* Deferred freeing for memory other threads may still be reading, using
+ * epoch based reclamation. Readers wrap every access in reaper_enter and
+ * reaper_exit, which only touch two counters and never block. Whoever
+ * unpublishes something hands it to reaper_retire, a background thread
+ * runs the free function once every reader that could have seen it has
+ * left, so the retiring thread doesn't wait for anything.
+ */
+
+typedef void (*reaper_fn)(void *param);
+
+/* Called on module load and unload, stopping runs everything still retired */
+void reaper_start(void);
+void reaper_stop(void);
+
+/* Returns the epoch to pass to reaper_exit. Sections can nest but should be
+ * short, the reaper waits for them
+ */
+long reaper_enter(void);
+void reaper_exit(long epoch);
+
+/* fn(param) runs on the reaper thread after a grace period. It may block,
+ * e.g. to stop a device, without holding up anything but later frees
+ */
+void reaper_retire(reaper_fn fn, void *param);
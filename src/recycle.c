@@ -0,0 +1,173 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <string.h>
+#include <util/base.h>
+#include <util/bmem.h>
+#include <util/darray.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#include "recycle.h"
+#include "plugin-macros.generated.h"
+
+struct recycled {
+    char *key;
+    void *item;
+    recycle_free_fn free_fn;
+    uint64_t expires;
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    /* In the order they were put, so also by expiry */
+    DARRAY(struct recycled) items;
+    uint64_t grace_ns;
+
+    os_event_t *wake;
+    pthread_t thread;
+    bool running;
+    volatile bool stopping;
+} recycle;
+
+static void free_items(struct recycled *items, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        items[i].free_fn(items[i].item);
+        bfree(items[i].key);
+    }
+}
+
+static void *recycle_thread(void *unused)
+{
+    UNUSED_PARAMETER(unused);
+    DARRAY(struct recycled) expired;
+    unsigned long wait_ms;
+
+    os_set_thread_name("muted-notification recycle");
+    da_init(expired);
+
+    while (!os_atomic_load_bool(&recycle.stopping)) {
+        uint64_t now = os_gettime_ns();
+
+        pthread_mutex_lock(&recycle.mutex);
+        size_t count = 0;
+        while (count < recycle.items.num && recycle.items.array[count].expires <= now)
+            count++;
+        if (count) {
+            da_push_back_array(expired, recycle.items.array, count);
+            da_erase_range(recycle.items, 0, count);
+        }
+        /* Sleeps until the next item expires, put wakes it for the first one */
+        wait_ms = recycle.items.num ? (unsigned long)((recycle.items.array[0].expires - now) / 1000000 + 1)
+                                    : (unsigned long)(recycle.grace_ns / 1000000);
+        pthread_mutex_unlock(&recycle.mutex);
+
+        /* Freeing may block (devices are stopped and closed), so it happens
+         * outside the lock
+         */
+        free_items(expired.array, expired.num);
+        da_resize(expired, 0);
+
+        os_event_timedwait(recycle.wake, wait_ms);
+    }
+
+    da_free(expired);
+    return NULL;
+}
+
+void recycle_start(uint32_t grace_ms)
+{
+    pthread_mutex_init(&recycle.mutex, NULL);
+    da_init(recycle.items);
+    recycle.grace_ns = (uint64_t)grace_ms * 1000000;
+    os_atomic_set_bool(&recycle.stopping, false);
+
+    if (os_event_init(&recycle.wake, OS_EVENT_TYPE_AUTO) != 0)
+        return;
+    recycle.running = pthread_create(&recycle.thread, NULL, recycle_thread, NULL) == 0;
+    if (!recycle.running)
+        blog(LOG_WARNING, "Failed to start the recycling thread, released devices and sounds are freed right away");
+}
+
+void recycle_stop(void)
+{
+    if (recycle.running) {
+        os_atomic_set_bool(&recycle.stopping, true);
+        os_event_signal(recycle.wake);
+        pthread_join(recycle.thread, NULL);
+        recycle.running = false;
+    }
+    os_event_destroy(recycle.wake);
+    recycle.wake = NULL;
+
+    free_items(recycle.items.array, recycle.items.num);
+    da_free(recycle.items);
+    pthread_mutex_destroy(&recycle.mutex);
+}
+
+void recycle_put(const char *key, void *item, recycle_free_fn free_fn)
+{
+    struct recycled r = {bstrdup(key), item, free_fn, os_gettime_ns() + recycle.grace_ns};
+    bool first;
+
+    if (!recycle.running) {
+        free_items(&r, 1);
+        return;
+    }
+
+    pthread_mutex_lock(&recycle.mutex);
+    first = !recycle.items.num;
+    da_push_back(recycle.items, &r);
+    pthread_mutex_unlock(&recycle.mutex);
+
+    if (first)
+        os_event_signal(recycle.wake);
+}
+
+static void *take(const char *key, bool prefix)
+{
+    size_t len = strlen(key);
+    void *item = NULL;
+
+    if (!recycle.running)
+        return NULL;
+
+    pthread_mutex_lock(&recycle.mutex);
+    for (size_t i = 0; i < recycle.items.num; i++) {
+        struct recycled *r = &recycle.items.array[i];
+        if (prefix ? strncmp(r->key, key, len) == 0 : strcmp(r->key, key) == 0) {
+            item = r->item;
+            bfree(r->key);
+            da_erase(recycle.items, i);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&recycle.mutex);
+    return item;
+}
+
+void *recycle_take(const char *key)
+{
+    return take(key, false);
+}
+
+void *recycle_take_prefix(const char *prefix)
+{
+    return take(prefix, true);
+}
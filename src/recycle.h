@@ -0,0 +1,45 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <stdint.h>
+
+/* Module wide pool that keeps released resources alive for a grace period
+ * so a new owner can take them over instead of building them again, e.g.
+ * when a scene collection switch destroys every filter and creates the same
+ * ones right after. Items are looked up by a string key describing exactly
+ * what they are, a thread frees whatever nobody took in time.
+ */
+
+typedef void (*recycle_free_fn)(void *item);
+
+void recycle_start(uint32_t grace_ms);
+/* Frees everything still in the pool */
+void recycle_stop(void);
+
+/* Hands item over to the pool, free_fn runs on the pool's thread once the
+ * grace period is over. Without a running pool item is freed right away
+ */
+void recycle_put(const char *key, void *item, recycle_free_fn free_fn);
+
+/* The oldest item put with this exact key, NULL if there is none */
+void *recycle_take(const char *key);
+
+/* Same, for any key starting with prefix */
+void *recycle_take_prefix(const char *prefix);
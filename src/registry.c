@@ -0,0 +1,166 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <string.h>
+#include <util/bmem.h>
+
+#include "registry.h"
+
+struct registry_page {
+    struct registry_slot slots[REGISTRY_PAGE_SLOTS];
+};
+
+static struct {
+    /* Serializes acquire, release and name changes, readers never take it */
+    pthread_mutex_t mutex;
+    struct registry_page *pages[REGISTRY_MAX_PAGES];
+    /* Pages are filled in before the count is raised past them */
+    volatile long page_count;
+} registry;
+
+void registry_init(void)
+{
+    pthread_mutex_init(&registry.mutex, NULL);
+}
+
+void registry_free(void)
+{
+    long count = os_atomic_load_long(&registry.page_count);
+    for (long i = 0; i < count; i++)
+        bfree(registry.pages[i]);
+    os_atomic_set_long(&registry.page_count, 0);
+    pthread_mutex_destroy(&registry.mutex);
+}
+
+static struct registry_slot *find_free_slot(void)
+{
+    long count = os_atomic_load_long(&registry.page_count);
+
+    for (long p = 0; p < count; p++) {
+        for (size_t i = 0; i < REGISTRY_PAGE_SLOTS; i++) {
+            struct registry_slot *slot = &registry.pages[p]->slots[i];
+            if (!(os_atomic_load_long(&slot->generation) & 1))
+                return slot;
+        }
+    }
+
+    if (count == REGISTRY_MAX_PAGES)
+        return NULL;
+    registry.pages[count] = bzalloc(sizeof(struct registry_page));
+    for (size_t i = 0; i < REGISTRY_PAGE_SLOTS; i++)
+        os_atomic_set_long(&registry.pages[count]->slots[i].last_trigger, -1);
+    os_atomic_set_long(&registry.page_count, count + 1);
+    return &registry.pages[count]->slots[0];
+}
+
+struct registry_slot *registry_acquire(uint32_t sample_rate)
+{
+    struct registry_slot *slot;
+
+    pthread_mutex_lock(&registry.mutex);
+    slot = find_free_slot();
+    if (slot) {
+        slot->sample_rate = sample_rate ? sample_rate : 48000;
+        slot->talk_frames = 0;
+        slot->notification_count = 0;
+        os_atomic_set_long(&slot->talk_ms, 0);
+        os_atomic_set_long(&slot->notifications, 0);
+        os_atomic_set_long(&slot->gate_open, 0);
+        os_atomic_set_long(&slot->last_trigger, -1);
+        for (size_t i = 0; i < REGISTRY_NAME_WORDS; i++)
+            os_atomic_set_long(&slot->name[i], 0);
+        /* Published last, readers skip the slot until now */
+        os_atomic_inc_long(&slot->generation);
+    }
+    pthread_mutex_unlock(&registry.mutex);
+    return slot;
+}
+
+void registry_release(struct registry_slot *slot)
+{
+    if (!slot)
+        return;
+    pthread_mutex_lock(&registry.mutex);
+    os_atomic_inc_long(&slot->generation);
+    pthread_mutex_unlock(&registry.mutex);
+}
+
+void registry_set_name(struct registry_slot *slot, const char *name)
+{
+    long words[REGISTRY_NAME_WORDS] = {0};
+    const char *src = name ? name : "";
+    size_t len = strnlen(src, REGISTRY_NAME_SIZE - 1);
+
+    if (!slot)
+        return;
+
+    /* A cut name ends before the character it would have split */
+    if (src[len])
+        while (len > 0 && ((unsigned char)src[len] & 0xc0) == 0x80)
+            len--;
+    memcpy(words, src, len);
+
+    pthread_mutex_lock(&registry.mutex);
+    os_atomic_inc_long(&slot->name_seq);
+    for (size_t i = 0; i < REGISTRY_NAME_WORDS; i++)
+        os_atomic_set_long(&slot->name[i], words[i]);
+    os_atomic_inc_long(&slot->name_seq);
+    pthread_mutex_unlock(&registry.mutex);
+}
+
+size_t registry_capacity(void)
+{
+    return (size_t)os_atomic_load_long(&registry.page_count) * REGISTRY_PAGE_SLOTS;
+}
+
+struct registry_slot *registry_slot_at(size_t index)
+{
+    if (index >= registry_capacity())
+        return NULL;
+    return &registry.pages[index / REGISTRY_PAGE_SLOTS]->slots[index % REGISTRY_PAGE_SLOTS];
+}
+
+bool registry_read(struct registry_slot *slot, struct registry_state *state)
+{
+    long words[REGISTRY_NAME_WORDS];
+    long generation = os_atomic_load_long(&slot->generation);
+    long seq, trigger;
+
+    if (!(generation & 1))
+        return false;
+
+    /* Renames are rare, retry until a copy wasn't overlapped by one */
+    do {
+        seq = os_atomic_load_long(&slot->name_seq);
+        for (size_t i = 0; i < REGISTRY_NAME_WORDS; i++)
+            words[i] = os_atomic_load_long(&slot->name[i]);
+    } while ((seq & 1) || seq != os_atomic_load_long(&slot->name_seq));
+
+    memcpy(state->name, words, REGISTRY_NAME_SIZE);
+    state->name[REGISTRY_NAME_SIZE - 1] = 0;
+
+    trigger = os_atomic_load_long(&slot->last_trigger);
+    state->generation = generation;
+    state->gate_open = os_atomic_load_long(&slot->gate_open) != 0;
+    state->has_triggered = trigger >= 0;
+    state->last_trigger = state->has_triggered ? (uint32_t)trigger : 0;
+    state->talk_ms = (uint32_t)os_atomic_load_long(&slot->talk_ms);
+    state->notifications = (uint32_t)os_atomic_load_long(&slot->notifications);
+
+    return os_atomic_load_long(&slot->generation) == generation;
+}
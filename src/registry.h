@@ -0,0 +1,112 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <util/threading.h>
+
+/* Module wide table of every filter's live state. Slots live in pages that
+ * are only freed on module unload, so other threads can read them without
+ * locking while filters come and go: a slot's generation is odd while a
+ * filter owns it and changes on every hand over, readers check it before
+ * and after copying. Each value is a single atomic long, the source name is
+ * stored as an array of them guarded by a sequence counter.
+ */
+
+#define REGISTRY_NAME_SIZE 128
+#define REGISTRY_NAME_WORDS (REGISTRY_NAME_SIZE / sizeof(long))
+#define REGISTRY_PAGE_SLOTS 64
+#define REGISTRY_MAX_PAGES 64
+/* Times and totals are kept to 31 bits so they fit a long everywhere, they
+ * wrap and only differences between two reads are meaningful
+ */
+#define REGISTRY_MASK 0x7fffffff
+
+struct registry_slot {
+    volatile long generation;
+    volatile long name_seq;
+    volatile long name[REGISTRY_NAME_WORDS];
+
+    /* Running totals, only written by the filter's audio thread */
+    volatile long talk_ms;
+    volatile long notifications;
+    volatile long gate_open;
+    /* Time of the last notification in ms, -1 before the first */
+    volatile long last_trigger;
+
+    /* Private to the audio thread */
+    uint32_t sample_rate;
+    uint64_t talk_frames;
+    uint32_t notification_count;
+
+    /* Private to the talk log, which reads the totals as increments */
+    long flushed_generation;
+    long flushed_talk_ms;
+    long flushed_notifications;
+};
+
+struct registry_state {
+    long generation;
+    char name[REGISTRY_NAME_SIZE];
+    bool gate_open;
+    bool has_triggered;
+    uint32_t last_trigger;
+    uint32_t talk_ms;
+    uint32_t notifications;
+};
+
+void registry_init(void);
+void registry_free(void);
+
+/* Returns NULL if all REGISTRY_MAX_PAGES pages are full */
+struct registry_slot *registry_acquire(uint32_t sample_rate);
+void registry_release(struct registry_slot *slot);
+
+/* Safe from any thread, writers are serialized internally. Names longer than
+ * REGISTRY_NAME_SIZE - 1 bytes are cut on a UTF-8 character boundary
+ */
+void registry_set_name(struct registry_slot *slot, const char *name);
+
+/* Lock free iteration: slots 0 to registry_capacity() - 1 always exist, most
+ * of them may be free
+ */
+size_t registry_capacity(void);
+struct registry_slot *registry_slot_at(size_t index);
+
+/* Copies a consistent snapshot, false if the slot is free or changed owner
+ * while it was read
+ */
+bool registry_read(struct registry_slot *slot, struct registry_state *state);
+
+/* Called by the audio thread once per block of a muted source */
+static inline void registry_publish(struct registry_slot *slot, uint32_t frames, bool open, bool triggered,
+                                    uint64_t time_ms)
+{
+    if (open) {
+        slot->talk_frames += frames;
+        os_atomic_set_long(&slot->talk_ms, (long)((slot->talk_frames * 1000 / slot->sample_rate) & REGISTRY_MASK));
+    }
+    if (triggered) {
+        slot->notification_count++;
+        os_atomic_set_long(&slot->notifications, (long)(slot->notification_count & REGISTRY_MASK));
+        os_atomic_set_long(&slot->last_trigger, (long)(time_ms & REGISTRY_MASK));
+    }
+    os_atomic_set_long(&slot->gate_open, open);
+}
@@ -0,0 +1,116 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <obs-module.h>
+#include <util/platform.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#include "registry.h"
+#include "state-query.h"
+
+#define PROC_GET_STATE "void muted_notification_get_state(out string json)"
+
+/* Calls in flight, unregistering waits for them before the registry goes */
+static volatile long callers;
+static volatile bool registered;
+
+static void get_state(void *unused, calldata_t *cd)
+{
+    UNUSED_PARAMETER(unused);
+
+    os_atomic_inc_long(&callers);
+    if (!os_atomic_load_bool(&registered)) {
+        calldata_set_string(cd, "json", "{\"sources\": []}");
+        os_atomic_dec_long(&callers);
+        return;
+    }
+
+    uint32_t now = (uint32_t)((os_gettime_ns() / 1000000) & REGISTRY_MASK);
+    obs_data_t *root = obs_data_create();
+    obs_data_array_t *sources = obs_data_array_create();
+    struct registry_state state;
+
+    for (size_t i = 0; i < registry_capacity(); i++) {
+        struct registry_slot *slot = registry_slot_at(i);
+        if (!slot || !registry_read(slot, &state))
+            continue;
+
+        obs_data_t *source = obs_data_create();
+        obs_data_set_string(source, "name", state.name);
+        obs_data_set_bool(source, "gate_open", state.gate_open);
+        obs_data_set_int(source, "talk_ms", state.talk_ms);
+        obs_data_set_int(source, "notifications", state.notifications);
+        obs_data_set_int(source, "last_notification_ms_ago",
+                         state.has_triggered ? (long long)((now - state.last_trigger) & REGISTRY_MASK) : -1);
+        obs_data_array_push_back(sources, source);
+        obs_data_release(source);
+    }
+
+    obs_data_set_array(root, "sources", sources);
+    calldata_set_string(cd, "json", obs_data_get_json(root));
+    obs_data_array_release(sources);
+    obs_data_release(root);
+    os_atomic_dec_long(&callers);
+}
+
+/* libobs can't remove a proc again, so get_state has to outlive the module:
+ * take a reference on our own library that is never dropped
+ */
+static void pin_module(void)
+{
+#ifdef _WIN32
+    HMODULE module;
+    if (!GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_PIN,
+                            (LPCWSTR)(void *)get_state, &module))
+        blog(LOG_WARNING, "Failed to pin the module, state queries after unload are unsafe");
+#else
+    Dl_info info;
+    if (!dladdr((void *)get_state, &info) || !info.dli_fname ||
+        !dlopen(info.dli_fname, RTLD_LAZY | RTLD_NOLOAD | RTLD_NODELETE))
+        blog(LOG_WARNING, "Failed to pin the module, state queries after unload are unsafe");
+#endif
+}
+
+void state_query_register(void)
+{
+    /* Registered once per process, a reloaded module finds it in place */
+    static bool added;
+
+    os_atomic_set_bool(&registered, true);
+    if (added)
+        return;
+    added = true;
+    pin_module();
+    proc_handler_add(obs_get_proc_handler(), PROC_GET_STATE, get_state, NULL);
+}
+
+void state_query_unregister(void)
+{
+    os_atomic_set_bool(&registered, false);
+    while (os_atomic_load_long(&callers))
+        os_sleep_ms(1);
+}
@@ -0,0 +1,33 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+/* Adds "void muted_notification_get_state(out string json)" to obs' global
+ * proc handler. One call returns every filter's state as
+ *
+ *   {"sources": [{"name": "Mic/Aux", "gate_open": false, "talk_ms": 5120,
+ *                 "notifications": 3, "last_notification_ms_ago": 8300}]}
+ *
+ * talk_ms and notifications are running totals since the filter was created
+ * (wrapping at 2^31), last_notification_ms_ago is -1 before the first one.
+ * Reads the registry only, so it never blocks or is blocked by audio.
+ */
+void state_query_register(void);
+/* Must run before registry_free(), later calls return no sources */
+void state_query_unregister(void);
@@ -0,0 +1,166 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <util/base.h>
+#include <util/bmem.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#include "talk-log.h"
+#include "plugin-macros.generated.h"
+
+static struct {
+    /* Guards pending and the flushed_* fields of the registry slots */
+    pthread_mutex_t mutex;
+    /* Rows of retired slots and rows that couldn't be written yet */
+    struct dstr pending;
+
+    char *path;
+    uint32_t interval_ms;
+    os_event_t *stop_event;
+    pthread_t thread;
+    bool running;
+} talk_log = {0};
+
+static void append_csv_string(struct dstr *out, const char *str)
+{
+    dstr_cat(out, "\"");
+    for (const char *c = str; *c; c++) {
+        if (*c == '"')
+            dstr_cat(out, "\"\"");
+        else if (*c != '\n' && *c != '\r')
+            dstr_ncat(out, c, 1);
+    }
+    dstr_cat(out, "\"");
+}
+
+/* Has to be called with the mutex held */
+static void collect_slot(struct registry_slot *slot, time_t now)
+{
+    struct registry_state state;
+
+    if (!registry_read(slot, &state))
+        return;
+
+    /* The slot changed hands since the last flush, the new owner starts at 0 */
+    if (state.generation != slot->flushed_generation) {
+        slot->flushed_generation = state.generation;
+        slot->flushed_talk_ms = 0;
+        slot->flushed_notifications = 0;
+    }
+
+    uint32_t talk_ms = (state.talk_ms - (uint32_t)slot->flushed_talk_ms) & REGISTRY_MASK;
+    uint32_t notifications = (state.notifications - (uint32_t)slot->flushed_notifications) & REGISTRY_MASK;
+    if (!talk_ms && !notifications)
+        return;
+
+    dstr_catf(&talk_log.pending, "%lld,", (long long)now);
+    append_csv_string(&talk_log.pending, state.name);
+    dstr_catf(&talk_log.pending, ",%u,%u\n", talk_ms, notifications);
+
+    slot->flushed_talk_ms = (long)state.talk_ms;
+    slot->flushed_notifications = (long)state.notifications;
+}
+
+static void flush(void)
+{
+    struct dstr rows = {0};
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&talk_log.mutex);
+    for (size_t i = 0; i < registry_capacity(); i++)
+        collect_slot(registry_slot_at(i), now);
+    dstr_move(&rows, &talk_log.pending);
+    pthread_mutex_unlock(&talk_log.mutex);
+
+    if (dstr_is_empty(&rows))
+        return;
+
+    bool exists = os_file_exists(talk_log.path);
+    FILE *f = os_fopen(talk_log.path, "ab");
+    if (f) {
+        if (!exists)
+            fputs("time,source,talk_ms,notifications\n", f);
+        fwrite(rows.array, 1, rows.len, f);
+        fclose(f);
+        dstr_free(&rows);
+        return;
+    }
+
+    /* Keep the rows for the next try, the config directory may come back */
+    blog(LOG_WARNING, "Failed to open talk log '%s'", talk_log.path);
+    pthread_mutex_lock(&talk_log.mutex);
+    dstr_cat_dstr(&rows, &talk_log.pending);
+    dstr_move(&talk_log.pending, &rows);
+    pthread_mutex_unlock(&talk_log.mutex);
+}
+
+static void *flush_thread(void *unused)
+{
+    UNUSED_PARAMETER(unused);
+    os_set_thread_name("muted-notification talk log");
+
+    while (os_event_timedwait(talk_log.stop_event, talk_log.interval_ms) == ETIMEDOUT)
+        flush();
+    return NULL;
+}
+
+void talk_log_start(const char *path, uint32_t interval_ms)
+{
+    pthread_mutex_init(&talk_log.mutex, NULL);
+    dstr_init(&talk_log.pending);
+    talk_log.path = bstrdup(path);
+    talk_log.interval_ms = interval_ms;
+
+    if (os_event_init(&talk_log.stop_event, OS_EVENT_TYPE_MANUAL) != 0)
+        return;
+    talk_log.running = pthread_create(&talk_log.thread, NULL, flush_thread, NULL) == 0;
+    if (!talk_log.running)
+        blog(LOG_WARNING, "Failed to start the talk log thread");
+}
+
+void talk_log_stop(void)
+{
+    if (talk_log.running) {
+        os_event_signal(talk_log.stop_event);
+        pthread_join(talk_log.thread, NULL);
+        talk_log.running = false;
+    }
+    if (talk_log.path)
+        flush();
+
+    os_event_destroy(talk_log.stop_event);
+    talk_log.stop_event = NULL;
+    dstr_free(&talk_log.pending);
+    bfree(talk_log.path);
+    talk_log.path = NULL;
+    pthread_mutex_destroy(&talk_log.mutex);
+}
+
+void talk_log_retire(struct registry_slot *slot)
+{
+    if (!slot)
+        return;
+    pthread_mutex_lock(&talk_log.mutex);
+    collect_slot(slot, time(NULL));
+    pthread_mutex_unlock(&talk_log.mutex);
+}
@@ -0,0 +1,44 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "registry.h"
+
+/* Accounting of how long people talked while muted and how many
+ * notifications that caused, per source. A background thread reads every
+ * filter's totals from the registry and appends the increments to a CSV log
+ * every interval:
+ *
+ *   unix_time,"source name",talk_ms,notifications
+ *
+ * Only intervals with activity get a row.
+ */
+
+/* Starts the flush thread, rows are appended to path (created if missing) */
+void talk_log_start(const char *path, uint32_t interval_ms);
+
+/* Writes what's left and joins the flush thread */
+void talk_log_stop(void);
+
+/* Keeps the slot's unflushed increments for the next flush, has to be called
+ * before the slot is released
+ */
+void talk_log_retire(struct registry_slot *slot);
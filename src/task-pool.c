@@ -0,0 +1,202 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <util/bmem.h>
+#include <util/circlebuf.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#include "task-pool.h"
+
+struct task {
+    task_pool_fn fn;
+    void *param;
+};
+
+struct task_pool {
+    pthread_t *threads;
+    size_t thread_count;
+    char *name;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t task_cond;
+    pthread_cond_t idle_cond;
+    struct circlebuf tasks;
+    size_t running;
+    bool stopping;
+
+    pthread_t poll_thread;
+    os_sem_t *poll_sem;
+    bool polling;
+    volatile bool poll_pending;
+    volatile bool poll_stopping;
+    task_pool_fn poll_fn;
+    void *poll_param;
+};
+
+static void *task_pool_thread(void *param)
+{
+    struct task_pool *pool = param;
+    struct task task;
+
+    os_set_thread_name(pool->name);
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (!pool->tasks.size && !pool->stopping)
+            pthread_cond_wait(&pool->task_cond, &pool->mutex);
+        if (!pool->tasks.size)
+            break;
+
+        circlebuf_pop_front(&pool->tasks, &task, sizeof(task));
+        pool->running++;
+        pthread_mutex_unlock(&pool->mutex);
+
+        task.fn(task.param);
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->running--;
+        if (!pool->running && !pool->tasks.size)
+            pthread_cond_broadcast(&pool->idle_cond);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+static void *task_pool_poll_thread(void *param)
+{
+    struct task_pool *pool = param;
+
+    os_set_thread_name(pool->name);
+    for (;;) {
+        if (os_sem_wait(pool->poll_sem) != 0 || os_atomic_load_bool(&pool->poll_stopping))
+            break;
+        /* Cleared before fn looks, a wake during fn runs it again */
+        os_atomic_set_bool(&pool->poll_pending, false);
+        pool->poll_fn(pool->poll_param);
+    }
+    return NULL;
+}
+
+struct task_pool *task_pool_create(size_t threads, const char *name)
+{
+    struct task_pool *pool = bzalloc(sizeof(*pool));
+
+    if (!threads)
+        threads = (size_t)os_get_logical_cores();
+    if (!threads)
+        threads = 1;
+
+    pool->name = bstrdup(name);
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->task_cond, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+    circlebuf_init(&pool->tasks);
+
+    pool->threads = bzalloc(sizeof(pthread_t) * threads);
+    for (size_t i = 0; i < threads; i++) {
+        if (pthread_create(&pool->threads[pool->thread_count], NULL, task_pool_thread, pool) != 0)
+            break;
+        pool->thread_count++;
+    }
+    return pool;
+}
+
+void task_pool_destroy(struct task_pool *pool)
+{
+    if (!pool)
+        return;
+
+    /* Stopped first, it may still push tasks */
+    if (pool->polling) {
+        os_atomic_set_bool(&pool->poll_stopping, true);
+        os_sem_post(pool->poll_sem);
+        pthread_join(pool->poll_thread, NULL);
+        os_sem_destroy(pool->poll_sem);
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->task_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (size_t i = 0; i < pool->thread_count; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    /* Nobody left to run them, so run whatever was pushed without a thread */
+    while (pool->tasks.size) {
+        struct task task;
+        circlebuf_pop_front(&pool->tasks, &task, sizeof(task));
+        task.fn(task.param);
+    }
+
+    circlebuf_free(&pool->tasks);
+    pthread_cond_destroy(&pool->idle_cond);
+    pthread_cond_destroy(&pool->task_cond);
+    pthread_mutex_destroy(&pool->mutex);
+    bfree(pool->threads);
+    bfree(pool->name);
+    bfree(pool);
+}
+
+void task_pool_push(struct task_pool *pool, task_pool_fn fn, void *param)
+{
+    struct task task = {fn, param};
+
+    pthread_mutex_lock(&pool->mutex);
+    circlebuf_push_back(&pool->tasks, &task, sizeof(task));
+    pthread_cond_signal(&pool->task_cond);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void task_pool_set_poll(struct task_pool *pool, task_pool_fn fn, void *param)
+{
+    if (pool->polling || os_sem_init(&pool->poll_sem, 0) != 0)
+        return;
+
+    pool->poll_fn = fn;
+    pool->poll_param = param;
+    pool->polling = pthread_create(&pool->poll_thread, NULL, task_pool_poll_thread, pool) == 0;
+    if (!pool->polling)
+        os_sem_destroy(pool->poll_sem);
+}
+
+void task_pool_wake_poll(struct task_pool *pool)
+{
+    /* Only the first wake since the last run posts, the rest ride along */
+    if (pool->polling && !os_atomic_set_bool(&pool->poll_pending, true))
+        os_sem_post(pool->poll_sem);
+}
+
+void task_pool_wait(struct task_pool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->running || pool->tasks.size) {
+        if (!pool->thread_count) {
+            pthread_mutex_unlock(&pool->mutex);
+            return;
+        }
+        pthread_cond_wait(&pool->idle_cond, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+size_t task_pool_thread_count(const struct task_pool *pool)
+{
+    return pool->thread_count;
+}
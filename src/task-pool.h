@@ -0,0 +1,51 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <stddef.h>
+
+/* Fixed size worker pool, tasks are run in the order they were pushed */
+
+struct task_pool;
+
+typedef void (*task_pool_fn)(void *param);
+
+struct task_pool *task_pool_create(size_t threads, const char *name);
+
+/* Finishes all queued tasks before joining the workers */
+void task_pool_destroy(struct task_pool *pool);
+
+void task_pool_push(struct task_pool *pool, task_pool_fn fn, void *param);
+
+/* Calls fn on a thread of its own after task_pool_wake_poll, until the pool
+ * is destroyed. For threads that mustn't block on the pool's mutex: they set
+ * a flag, wake the poll and fn turns the flag into a task. Only one poll per
+ * pool
+ */
+void task_pool_set_poll(struct task_pool *pool, task_pool_fn fn, void *param);
+
+/* Doesn't lock or allocate, wakes that pile up before fn runs collapse into
+ * one run
+ */
+void task_pool_wake_poll(struct task_pool *pool);
+
+/* Blocks until every task pushed so far has finished */
+void task_pool_wait(struct task_pool *pool);
+
+size_t task_pool_thread_count(const struct task_pool *pool);
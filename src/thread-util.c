@@ -0,0 +1,179 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "thread-util.h"
+
+bool thread_parse_affinity(const char *str, uint64_t *mask)
+{
+    const char *c = str;
+    *mask = 0;
+
+    while (*c) {
+        char *end;
+        long first = strtol(c, &end, 10), last;
+        if (end == c || first < 0 || first > 63)
+            return false;
+        last = first;
+        if (*end == '-') {
+            c = end + 1;
+            last = strtol(c, &end, 10);
+            if (end == c || last < first || last > 63)
+                return false;
+        }
+        for (long i = first; i <= last; i++)
+            *mask |= (uint64_t)1 << i;
+
+        while (*end == ' ')
+            end++;
+        if (*end == ',')
+            end++;
+        else if (*end)
+            return false;
+        c = end;
+        while (*c == ' ')
+            c++;
+    }
+    return true;
+}
+
+#if defined(_WIN32)
+bool thread_set_affinity(uint64_t mask)
+{
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)mask) != 0;
+}
+
+bool thread_set_realtime(void)
+{
+    return false;
+}
+
+void thread_get_sched_info(struct thread_sched_info *info)
+{
+    int priority = GetThreadPriority(GetCurrentThread());
+
+    info->priority = priority;
+    info->affinity = 0;
+    switch (priority) {
+    case THREAD_PRIORITY_IDLE:
+        info->policy = "IDLE";
+        break;
+    case THREAD_PRIORITY_LOWEST:
+        info->policy = "LOWEST";
+        break;
+    case THREAD_PRIORITY_BELOW_NORMAL:
+        info->policy = "BELOW_NORMAL";
+        break;
+    case THREAD_PRIORITY_NORMAL:
+        info->policy = "NORMAL";
+        break;
+    case THREAD_PRIORITY_ABOVE_NORMAL:
+        info->policy = "ABOVE_NORMAL";
+        break;
+    case THREAD_PRIORITY_HIGHEST:
+        info->policy = "HIGHEST";
+        break;
+    case THREAD_PRIORITY_TIME_CRITICAL:
+        info->policy = "TIME_CRITICAL";
+        break;
+    default:
+        info->policy = "UNKNOWN";
+    }
+}
+#else
+bool thread_set_affinity(uint64_t mask)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < 64; i++) {
+        if (mask & ((uint64_t)1 << i))
+            CPU_SET(i, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    /* macOS only has affinity tags, which are hints for cache sharing */
+    (void)mask;
+    return false;
+#endif
+}
+
+bool thread_set_realtime(void)
+{
+#if defined(__linux__)
+    /* Well above desktop audio servers' defaults, but not the maximum */
+    struct sched_param param = {.sched_priority = sched_get_priority_min(SCHED_FIFO) + 40};
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#else
+    return false;
+#endif
+}
+
+void thread_get_sched_info(struct thread_sched_info *info)
+{
+    struct sched_param param = {0};
+    int policy = SCHED_OTHER;
+
+    pthread_getschedparam(pthread_self(), &policy, &param);
+    info->priority = param.sched_priority;
+    info->affinity = 0;
+
+    switch (policy) {
+    case SCHED_FIFO:
+        info->policy = "SCHED_FIFO";
+        break;
+    case SCHED_RR:
+        info->policy = "SCHED_RR";
+        break;
+#if defined(SCHED_IDLE)
+    case SCHED_IDLE:
+        info->policy = "SCHED_IDLE";
+        break;
+#endif
+#if defined(SCHED_BATCH)
+    case SCHED_BATCH:
+        info->policy = "SCHED_BATCH";
+        break;
+#endif
+    default:
+        info->policy = "SCHED_OTHER";
+    }
+
+#if defined(__linux__)
+    cpu_set_t set;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+        for (int i = 0; i < 64; i++) {
+            if (CPU_ISSET(i, &set))
+                info->affinity |= (uint64_t)1 << i;
+        }
+    }
+#endif
+}
+#endif
@@ -0,0 +1,53 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Scheduling helpers for threads the plugin doesn't create itself (the audio
+ * backend's callback thread), they all act on the calling thread
+ */
+
+struct thread_sched_info {
+    /* e.g. "SCHED_OTHER", "SCHED_FIFO" or "TIME_CRITICAL" */
+    const char *policy;
+    int priority;
+    /* CPUs the thread may run on, 0 if the platform can't tell */
+    uint64_t affinity;
+};
+
+/* Parses a cpu list like "0,2-3" into a mask of the first 64 cpus, an empty
+ * string gives 0 which means no restriction
+ */
+bool thread_parse_affinity(const char *str, uint64_t *mask);
+
+/* Returns false if the platform doesn't support it (macOS) or the mask was
+ * rejected, e.g. no listed cpu exists
+ */
+bool thread_set_affinity(uint64_t mask);
+
+/* Moves the thread to the fifo real time class on Linux. Thread priorities
+ * set through pthread attributes are ignored there unless the thread is
+ * created with explicit scheduling, which miniaudio doesn't do. Needs
+ * CAP_SYS_NICE or an RLIMIT_RTPRIO, other platforms return false
+ */
+bool thread_set_realtime(void);
+
+void thread_get_sched_info(struct thread_sched_info *info);
@@ -0,0 +1,156 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/**
+ * Build time helper: decodes a 16 bit or float WAV file, trims the silence at
+ * both ends and writes it out as a C array of interleaved float samples.
+ * Deliberately has no dependencies so it can run before anything else is built.
+ */
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Anything quieter than -60 dBFS at the start or end is cut off */
+#define TRIM_THRESHOLD 0.001f
+
+static uint32_t read_u32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t read_u16(const unsigned char *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static unsigned char *read_file(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    unsigned char *buf;
+
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    *size = (size_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(*size);
+    if (buf && fread(buf, 1, *size, f) != *size) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    return buf;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned char *wav, *pcm = NULL;
+    size_t size, pos = 12, pcm_size = 0;
+    uint16_t format = 0, channels = 0, bits = 0;
+    uint32_t sample_rate = 0;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <input.wav> <output.h>\n", argv[0]);
+        return 1;
+    }
+
+    wav = read_file(argv[1], &size);
+    if (!wav || size < 12 || memcmp(wav, "RIFF", 4) != 0 || memcmp(wav + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "'%s' is not a WAV file\n", argv[1]);
+        return 1;
+    }
+
+    while (pos + 8 <= size) {
+        uint32_t chunk = read_u32(wav + pos + 4);
+        const unsigned char *body = wav + pos + 8;
+
+        if (pos + 8 + chunk > size)
+            break;
+        if (memcmp(wav + pos, "fmt ", 4) == 0 && chunk >= 16) {
+            format = read_u16(body);
+            channels = read_u16(body + 2);
+            sample_rate = read_u32(body + 4);
+            bits = read_u16(body + 14);
+            if (format == 0xFFFE && chunk >= 26) /* WAVE_FORMAT_EXTENSIBLE, sub format follows */
+                format = read_u16(body + 24);
+        } else if (memcmp(wav + pos, "data", 4) == 0) {
+            pcm = (unsigned char *)body;
+            pcm_size = chunk;
+        }
+        pos += 8 + chunk + (chunk & 1);
+    }
+
+    if (!pcm || !channels || !sample_rate || !((format == 1 && bits == 16) || (format == 3 && bits == 32))) {
+        fprintf(stderr, "'%s' has to be 16 bit PCM or 32 bit float\n", argv[1]);
+        return 1;
+    }
+
+    size_t frames = pcm_size / (channels * (bits / 8));
+    float *samples = malloc(sizeof(float) * frames * channels);
+    for (size_t i = 0; i < frames * channels; i++) {
+        if (format == 1) {
+            samples[i] = (float)(int16_t)read_u16(pcm + i * 2) / 32768.0f;
+        } else {
+            uint32_t bits32 = read_u32(pcm + i * 4);
+            memcpy(&samples[i], &bits32, sizeof(float));
+        }
+    }
+
+    size_t first = 0, last = 0;
+    bool found = false;
+    for (size_t i = 0; i < frames; i++) {
+        for (size_t c = 0; c < channels; c++) {
+            if (fabsf(samples[i * channels + c]) > TRIM_THRESHOLD) {
+                if (!found)
+                    first = i;
+                found = true;
+                last = i;
+            }
+        }
+    }
+    size_t trimmed = found ? last - first + 1 : 0;
+
+    FILE *out = fopen(argv[2], "w");
+    if (!out) {
+        fprintf(stderr, "Failed to write '%s'\n", argv[2]);
+        return 1;
+    }
+
+    fprintf(out,
+            "/* Generated by embed-clip, do not edit */\n"
+            "#pragma once\n\n"
+            "#define CLIP_BUILTIN_FRAMES %zu\n"
+            "#define CLIP_BUILTIN_CHANNELS %u\n"
+            "#define CLIP_BUILTIN_SAMPLE_RATE %u\n\n"
+            "static const float clip_builtin_data[] = {\n",
+            trimmed, channels, sample_rate);
+    for (size_t i = 0; i < trimmed * channels; i++)
+        fprintf(out, "%#.9gf,%s", samples[first * channels + i], i % 8 == 7 ? "\n" : " ");
+    if (!trimmed)
+        fprintf(out, "0.0f");
+    fprintf(out, "\n};\n");
+    fclose(out);
+
+    printf("%s: %zu of %zu frames kept\n", argv[1], trimmed, frames);
+    free(samples);
+    free(wav);
+    return 0;
+}
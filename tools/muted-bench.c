@@ -0,0 +1,1032 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/**
+ * Benchmarks for the filter's building blocks, run on miniaudio's null
+ * backend so no real audio hardware is needed.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/bmem.h>
+#include <util/darray.h>
+#include <util/platform.h>
+
+#include "clip.h"
+#include "playback.h"
+#include "recycle.h"
+#include "task-pool.h"
+#include "tool-common.h"
+
+#define BENCH_CHANNELS 2
+#define NULL_DEVICE "NULL Playback Device"
+
+struct bench_instance {
+    struct detector detector;
+    struct playback playback;
+    const struct playback_settings *settings;
+};
+
+struct bench_options {
+    DARRAY(int) counts;
+    double seconds;
+    const char *clip;
+    int iterations;
+    bool system_backend;
+    const char *device;
+    int jobs;
+    ma_thread_priority priority;
+    uint64_t affinity;
+};
+
+struct phase_stats {
+    const char *name;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+};
+
+static void bench_log(void *param, ma_uint32 level, const char *message)
+{
+    UNUSED_PARAMETER(param);
+    if (level <= MA_LOG_LEVEL_WARNING)
+        fprintf(stderr, "miniaudio: %s", message);
+}
+
+/* Quiet room noise around -60 dBFS, what a muted mic carries most of the time */
+static void fill_idle_noise(float **planes, size_t channels, size_t frames, uint32_t *seed)
+{
+    for (size_t c = 0; c < channels; c++) {
+        for (size_t i = 0; i < frames; i++) {
+            *seed = *seed * 1664525u + 1013904223u;
+            planes[c][i] = ((float)(*seed >> 8) / 16777216.0f - 0.5f) * 0.002f;
+        }
+    }
+}
+
+static double mib(int64_t bytes)
+{
+    return bytes < 0 ? -1.0 : (double)bytes / (1024.0 * 1024.0);
+}
+
+/* The part of muted_create the plugin runs on its setup pool */
+static void instance_setup(void *param)
+{
+    const ma_backend null_backend = ma_backend_null;
+    struct bench_instance *inst = param;
+
+    if (playback_init(&inst->playback, &null_backend, 1, bench_log, inst))
+        playback_update(&inst->playback, inst->settings);
+}
+
+static void bench_instances(const struct bench_options *opt)
+{
+    const struct playback_settings ps = {.path = opt->clip, .device = NULL_DEVICE};
+    struct detector_settings settings;
+    float *planes[BENCH_CHANNELS];
+    uint32_t seed = 1;
+    int64_t base_rss, rss;
+    int base_threads, threads;
+    struct task_pool *pool = NULL;
+
+    /* Like the plugin the pool lives for the whole run, its idle workers count towards threads */
+    if (opt->jobs != 1)
+        pool = task_pool_create((size_t)opt->jobs, "muted-bench setup");
+
+    tool_detector_defaults(&settings);
+    for (size_t c = 0; c < BENCH_CHANNELS; c++)
+        planes[c] = bmalloc(sizeof(float) * TOOL_BLOCK_FRAMES);
+
+    printf("instances,create_ms,create_per_instance_ms,block_us,block_per_instance_us,realtime_pct,rss_mib,"
+           "rss_per_instance_kib,threads,destroy_ms\n");
+
+    for (size_t n = 0; n < opt->counts.num; n++) {
+        size_t count = (size_t)opt->counts.array[n];
+        struct bench_instance *instances = bzalloc(sizeof(struct bench_instance) * count);
+
+        tool_process_stats(&base_rss, &base_threads);
+
+        /* Same steps as muted_create -> muted_update, timed until every instance is ready */
+        uint64_t start = os_gettime_ns();
+        for (size_t i = 0; i < count; i++) {
+            struct bench_instance *inst = &instances[i];
+            detector_update(&inst->detector, &settings, (float)TOOL_DEFAULT_SAMPLE_RATE);
+            inst->settings = &ps;
+            if (pool)
+                task_pool_push(pool, instance_setup, inst);
+            else
+                instance_setup(inst);
+        }
+        if (pool)
+            task_pool_wait(pool);
+        uint64_t create_ns = os_gettime_ns() - start;
+
+        tool_process_stats(&rss, &threads);
+
+        /* One obs audio thread tick runs filter_audio of every instance */
+        size_t blocks = (size_t)(opt->seconds * TOOL_DEFAULT_SAMPLE_RATE / TOOL_BLOCK_FRAMES);
+        uint64_t cpu = 0, frames = 0;
+        for (size_t b = 0; b < blocks; b++) {
+            fill_idle_noise(planes, BENCH_CHANNELS, TOOL_BLOCK_FRAMES, &seed);
+            frames += TOOL_BLOCK_FRAMES;
+
+            uint64_t tick = tool_thread_cpu_ns();
+            for (size_t i = 0; i < count; i++) {
+                struct bench_instance *inst = &instances[i];
+                detector_process(&inst->detector, planes, BENCH_CHANNELS, TOOL_BLOCK_FRAMES);
+                if (detector_check_trigger(&inst->detector, frames * 1000 / TOOL_DEFAULT_SAMPLE_RATE,
+                                           playback_file_length(&inst->playback)))
+                    playback_play(&inst->playback);
+            }
+            cpu += tool_thread_cpu_ns() - tick;
+        }
+
+        start = os_gettime_ns();
+        for (size_t i = 0; i < count; i++)
+            playback_free(&instances[i].playback);
+        uint64_t destroy_ns = os_gettime_ns() - start;
+
+        double block_us = blocks ? (double)cpu / (double)blocks / 1000.0 : 0.0;
+        double budget_us = (double)TOOL_BLOCK_FRAMES * 1e6 / TOOL_DEFAULT_SAMPLE_RATE;
+        printf("%i,%.2f,%.3f,%.2f,%.3f,%.3f,%.1f,%.1f,%i,%.2f\n", (int)count, (double)create_ns / 1e6,
+               (double)create_ns / 1e6 / (double)count, block_us, block_us / (double)count,
+               100.0 * block_us / budget_us, mib(rss),
+               rss < 0 || base_rss < 0 ? -1.0 : (double)(rss - base_rss) / 1024.0 / (double)count, threads,
+               (double)destroy_ns / 1e6);
+        fflush(stdout);
+        bfree(instances);
+    }
+
+    task_pool_destroy(pool);
+    for (size_t c = 0; c < BENCH_CHANNELS; c++)
+        bfree(planes[c]);
+}
+
+static uint64_t create_instances(struct bench_instance *instances, size_t count, const struct playback_settings *ps)
+{
+    uint64_t start = os_gettime_ns();
+    for (size_t i = 0; i < count; i++) {
+        instances[i].settings = ps;
+        instance_setup(&instances[i]);
+    }
+    return os_gettime_ns() - start;
+}
+
+static uint64_t free_instances(struct bench_instance *instances, size_t count)
+{
+    uint64_t start = os_gettime_ns();
+    for (size_t i = 0; i < count; i++)
+        playback_free(&instances[i].playback);
+    memset(instances, 0, sizeof(struct bench_instance) * count);
+    return os_gettime_ns() - start;
+}
+
+/* A scene collection switch: every instance is destroyed and the same ones
+ * are created again, once without and once with the recycling pool
+ */
+static void bench_recycle(const struct bench_options *opt)
+{
+    const struct playback_settings ps = {.path = opt->clip, .device = NULL_DEVICE};
+
+    printf("instances,create_ms,destroy_ms,recreate_ms,recycled_recreate_ms,recycled_destroy_ms\n");
+
+    for (size_t n = 0; n < opt->counts.num; n++) {
+        size_t count = (size_t)opt->counts.array[n];
+        struct bench_instance *instances = bzalloc(sizeof(struct bench_instance) * count);
+
+        uint64_t create_ns = create_instances(instances, count, &ps);
+        uint64_t destroy_ns = free_instances(instances, count);
+        uint64_t recreate_ns = create_instances(instances, count, &ps);
+        free_instances(instances, count);
+
+        recycle_start(10000);
+        create_instances(instances, count, &ps);
+        uint64_t recycled_destroy_ns = free_instances(instances, count);
+        uint64_t recycled_ns = create_instances(instances, count, &ps);
+        free_instances(instances, count);
+        recycle_stop();
+
+        printf("%i,%.2f,%.2f,%.2f,%.2f,%.2f\n", (int)count, (double)create_ns / 1e6, (double)destroy_ns / 1e6,
+               (double)recreate_ns / 1e6, (double)recycled_ns / 1e6, (double)recycled_destroy_ns / 1e6);
+        fflush(stdout);
+        bfree(instances);
+    }
+}
+
+static void phase_add(struct phase_stats *phase, uint64_t ns)
+{
+    phase->total += ns;
+    if (!phase->min || ns < phase->min)
+        phase->min = ns;
+    if (ns > phase->max)
+        phase->max = ns;
+}
+
+/* Creates and destroys a single instance repeatedly, timing each step of
+ * muted_create. Module load and obs_module_file need a running obs, those
+ * phases are covered by the profiler scopes in plugin-main.c
+ */
+static void bench_startup(const struct bench_options *opt)
+{
+    const ma_backend null_backend = ma_backend_null;
+    const char *device = opt->device ? opt->device : NULL_DEVICE;
+    /* No device has an empty name, so the first update only loads the clip */
+    const struct playback_settings load_ps = {.path = opt->clip, .device = ""};
+    const struct playback_settings open_ps = {.path = opt->clip, .device = device};
+    struct phase_stats phases[] = {{.name = "context_init"}, {.name = "load_clip"}, {.name = "open_device"},
+                                   {.name = "total"}, {.name = "destroy"}};
+
+    for (int i = 0; i < opt->iterations; i++) {
+        struct playback p = {0};
+        uint64_t t0 = os_gettime_ns();
+        bool ok = opt->system_backend ? playback_init(&p, NULL, 0, bench_log, NULL)
+                                      : playback_init(&p, &null_backend, 1, bench_log, NULL);
+        uint64_t t1 = os_gettime_ns();
+        if (ok)
+            playback_update(&p, &load_ps);
+        uint64_t t2 = os_gettime_ns();
+        if (ok)
+            playback_update(&p, &open_ps);
+        uint64_t t3 = os_gettime_ns();
+        playback_free(&p);
+        uint64_t t4 = os_gettime_ns();
+
+        phase_add(&phases[0], t1 - t0);
+        phase_add(&phases[1], t2 - t1);
+        phase_add(&phases[2], t3 - t2);
+        phase_add(&phases[3], t3 - t0);
+        phase_add(&phases[4], t4 - t3);
+    }
+
+    printf("phase,mean_ms,min_ms,max_ms\n");
+    for (size_t i = 0; i < sizeof(phases) / sizeof(phases[0]); i++) {
+        printf("%s,%.3f,%.3f,%.3f\n", phases[i].name, (double)phases[i].total / 1e6 / (double)opt->iterations,
+               (double)phases[i].min / 1e6, (double)phases[i].max / 1e6);
+    }
+}
+
+static void bench_thread(const struct bench_options *opt)
+{
+    const ma_backend null_backend = ma_backend_null;
+    const struct playback_settings ps = {.path = opt->clip,
+                                         .device = opt->device ? opt->device : NULL_DEVICE,
+                                         .thread_priority = opt->priority,
+                                         .affinity = opt->affinity};
+    struct playback p = {0};
+    struct playback_stats stats = {0};
+
+    bool ok = opt->system_backend ? playback_init(&p, NULL, 0, bench_log, NULL)
+                                  : playback_init(&p, &null_backend, 1, bench_log, NULL);
+    if (ok) {
+        playback_update(&p, &ps);
+        playback_play(&p);
+        for (int i = 0; i < 100 && !stats.thread_known; i++) {
+            os_sleep_ms(10);
+            playback_get_stats(&p, &stats);
+        }
+    }
+    playback_free(&p);
+
+    if (!stats.thread_known) {
+        fprintf(stderr, "The device never called back\n");
+        return;
+    }
+    printf("policy,priority,affinity,realtime_denied,affinity_denied\n%s,%d,0x%llx,%d,%d\n", stats.thread.policy,
+           stats.thread.priority, (unsigned long long)stats.thread.affinity, stats.realtime_denied,
+           stats.affinity_denied);
+}
+
+/* Waits until the callback has picked up the last playback_play */
+static bool wait_started(struct playback *p, uint32_t starts, struct playback_stats *stats)
+{
+    for (int i = 0; i < 500; i++) {
+        playback_get_stats(p, stats);
+        if (stats->warm_starts + stats->cold_starts > starts)
+            return true;
+        os_sleep_ms(1);
+    }
+    return false;
+}
+
+static void bench_prewarm(const struct bench_options *opt)
+{
+    const ma_backend null_backend = ma_backend_null;
+    const struct playback_settings ps = {.path = opt->clip, .device = opt->device ? opt->device : NULL_DEVICE};
+    struct playback p = {0};
+    struct playback_stats stats = {0};
+    uint32_t starts = 0;
+
+    bool ok = opt->system_backend ? playback_init(&p, NULL, 0, bench_log, NULL)
+                                  : playback_init(&p, &null_backend, 1, bench_log, NULL);
+    if (ok)
+        playback_update(&p, &ps);
+
+    /* Alternates starting a stopped device with starting one that was
+     * prepared while the level was still below the open threshold
+     */
+    for (int i = 0; ok && i < opt->iterations * 2; i++) {
+        while (playback_is_playing(&p))
+            os_sleep_ms(1);
+        playback_release_idle(&p, 0);
+        if (i % 2) {
+            playback_prepare(&p);
+            os_sleep_ms(50);
+        }
+        playback_play(&p);
+        ok = wait_started(&p, starts++, &stats);
+    }
+    playback_free(&p);
+
+    if (!ok) {
+        fprintf(stderr, "The device never started playing\n");
+        return;
+    }
+    printf("start,count,mean_ms\ncold,%u,%.3f\nwarm,%u,%.3f\nsaved,,%.3f\n", stats.cold_starts,
+           stats.cold_latency_ms, stats.warm_starts, stats.warm_latency_ms,
+           stats.cold_latency_ms - stats.warm_latency_ms);
+}
+
+/* Voiced speech stand-in: 140 Hz fundamental with falling harmonics and a
+ * 10 ms fade in, peaking around -14 dBFS
+ */
+static float speech_sample(size_t n)
+{
+    const double t = (double)n / TOOL_DEFAULT_SAMPLE_RATE;
+    const double ramp = t < 0.01 ? t / 0.01 : 1.0;
+    double v = 0.0;
+    for (int h = 1; h <= 6; h++)
+        v += sin(2.0 * 3.14159265358979 * 140.0 * h * t) / h;
+    return (float)(v * 0.12 * ramp);
+}
+
+/* Block in which the gate first opens for a speech onset at frame onset */
+static int64_t onset_block(const struct detector_settings *settings, float **idle, size_t idle_blocks, size_t onset,
+                           float **planes)
+{
+    struct detector d = {0};
+    size_t blocks = onset / TOOL_BLOCK_FRAMES + TOOL_DEFAULT_SAMPLE_RATE / TOOL_BLOCK_FRAMES;
+
+    detector_update(&d, settings, (float)TOOL_DEFAULT_SAMPLE_RATE);
+    for (size_t b = 0; b < blocks; b++) {
+        for (size_t c = 0; c < BENCH_CHANNELS; c++) {
+            const float *src = idle[c] + (b % idle_blocks) * TOOL_BLOCK_FRAMES;
+            for (size_t i = 0; i < TOOL_BLOCK_FRAMES; i++) {
+                size_t n = b * TOOL_BLOCK_FRAMES + i;
+                planes[c][i] = src[i] + (n >= onset ? speech_sample(n - onset) : 0.0f);
+            }
+        }
+        if (detector_process(&d, planes, BENCH_CHANNELS, TOOL_BLOCK_FRAMES))
+            return (int64_t)b;
+    }
+    return -1;
+}
+
+static void bench_scan(const struct bench_options *opt)
+{
+    const int strides[] = {0, 4, 8, 16, 32};
+    const size_t idle_blocks = 10 * TOOL_DEFAULT_SAMPLE_RATE / TOOL_BLOCK_FRAMES;
+    const size_t blocks = (size_t)(opt->seconds * TOOL_DEFAULT_SAMPLE_RATE / TOOL_BLOCK_FRAMES);
+    const double block_ms = (double)TOOL_BLOCK_FRAMES * 1000.0 / TOOL_DEFAULT_SAMPLE_RATE;
+    const int trials = 200;
+    struct detector_settings settings;
+    float *idle[BENCH_CHANNELS], *planes[BENCH_CHANNELS];
+    uint32_t seed = 1;
+    double full_ns = 0.0;
+
+    tool_detector_defaults(&settings);
+
+    /* Generated up front, so the timing only covers the detector */
+    for (size_t c = 0; c < BENCH_CHANNELS; c++) {
+        idle[c] = bmalloc(sizeof(float) * TOOL_BLOCK_FRAMES * idle_blocks);
+        planes[c] = bmalloc(sizeof(float) * TOOL_BLOCK_FRAMES);
+    }
+    fill_idle_noise(idle, BENCH_CHANNELS, TOOL_BLOCK_FRAMES * idle_blocks, &seed);
+
+    printf("stride,block_ns,speedup,mean_added_ms,max_added_ms,missed\n");
+    for (size_t s = 0; s < sizeof(strides) / sizeof(strides[0]); s++) {
+        struct detector d = {0};
+        float *block[BENCH_CHANNELS];
+
+        settings.scan_stride = strides[s];
+        detector_update(&d, &settings, (float)TOOL_DEFAULT_SAMPLE_RATE);
+
+        uint64_t start = tool_thread_cpu_ns();
+        for (size_t b = 0; b < blocks; b++) {
+            for (size_t c = 0; c < BENCH_CHANNELS; c++)
+                block[c] = idle[c] + (b % idle_blocks) * TOOL_BLOCK_FRAMES;
+            detector_process(&d, block, BENCH_CHANNELS, TOOL_BLOCK_FRAMES);
+        }
+        double ns = blocks ? (double)(tool_thread_cpu_ns() - start) / (double)blocks : 0.0;
+        if (!strides[s])
+            full_ns = ns;
+
+        /* Onsets at pseudo random frames after a few seconds of idle noise, compared to a full scan */
+        double added_total = 0.0, added_max = 0.0;
+        int missed = 0, measured = 0;
+        for (int t = 0; t < trials && strides[s]; t++) {
+            size_t onset = 2 * TOOL_DEFAULT_SAMPLE_RATE + ((size_t)t * 7919u) % (TOOL_DEFAULT_SAMPLE_RATE);
+            struct detector_settings full = settings;
+            full.scan_stride = 0;
+            int64_t ref = onset_block(&full, idle, idle_blocks, onset, planes);
+            int64_t got = onset_block(&settings, idle, idle_blocks, onset, planes);
+            if (got < 0 || ref < 0) {
+                missed++;
+                continue;
+            }
+            double added = (double)(got - ref) * block_ms;
+            added_total += added;
+            added_max = added > added_max ? added : added_max;
+            measured++;
+        }
+
+        printf("%d,%.0f,%.2f,%.2f,%.2f,%d\n", strides[s], ns, ns > 0.0 ? full_ns / ns : 0.0,
+               measured ? added_total / measured : 0.0, added_max, missed);
+        fflush(stdout);
+    }
+
+    for (size_t c = 0; c < BENCH_CHANNELS; c++) {
+        bfree(idle[c]);
+        bfree(planes[c]);
+    }
+}
+
+/* Idle noise with a second of speech every other second */
+static void fill_talk(float **planes, size_t channels, size_t frames, uint32_t *seed)
+{
+    fill_idle_noise(planes, channels, frames, seed);
+    for (size_t c = 0; c < channels; c++) {
+        for (size_t i = 0; i < frames; i++) {
+            if ((i / TOOL_DEFAULT_SAMPLE_RATE) % 2)
+                planes[c][i] += speech_sample(i % TOOL_DEFAULT_SAMPLE_RATE);
+        }
+    }
+}
+
+enum gate_mode {
+    GATE_DETECT,
+    GATE_SEPARATE,
+    GATE_COMBINED,
+};
+
+/* Audio thread cpu per block, the copy into planes is timed for every mode alike */
+static double gate_block_ns(enum gate_mode mode, float **signal, size_t frames, float **planes)
+{
+    struct detector_settings settings;
+    struct detector detect = {0}, gate = {0};
+    const size_t blocks = frames / TOOL_BLOCK_FRAMES;
+
+    tool_detector_defaults(&settings);
+    detector_update(&detect, &settings, (float)TOOL_DEFAULT_SAMPLE_RATE);
+    detector_update(&gate, &settings, (float)TOOL_DEFAULT_SAMPLE_RATE);
+
+    uint64_t start = tool_thread_cpu_ns();
+    for (size_t b = 0; b < blocks; b++) {
+        for (size_t c = 0; c < BENCH_CHANNELS; c++)
+            memcpy(planes[c], signal[c] + b * TOOL_BLOCK_FRAMES, sizeof(float) * TOOL_BLOCK_FRAMES);
+
+        switch (mode) {
+        case GATE_DETECT:
+            detector_process(&detect, planes, BENCH_CHANNELS, TOOL_BLOCK_FRAMES);
+            break;
+        case GATE_SEPARATE:
+            /* A noise gate filter followed by this one, each running the envelope */
+            detector_process_gate(&gate, planes, BENCH_CHANNELS, TOOL_BLOCK_FRAMES);
+            detector_process(&detect, planes, BENCH_CHANNELS, TOOL_BLOCK_FRAMES);
+            break;
+        case GATE_COMBINED:
+            detector_process_gate(&detect, planes, BENCH_CHANNELS, TOOL_BLOCK_FRAMES);
+            break;
+        }
+    }
+    return blocks ? (double)(tool_thread_cpu_ns() - start) / (double)blocks : 0.0;
+}
+
+/* Largest difference between the gated output and multiplying every sample
+ * by the attenuation after its frame, like obs' noise gate does
+ */
+static double gate_max_error(float **signal, size_t frames, float **planes)
+{
+    struct detector_settings settings;
+    struct detector gate = {0}, ref = {0};
+    double max_error = 0.0;
+
+    tool_detector_defaults(&settings);
+    detector_update(&gate, &settings, (float)TOOL_DEFAULT_SAMPLE_RATE);
+    detector_update(&ref, &settings, (float)TOOL_DEFAULT_SAMPLE_RATE);
+
+    for (size_t b = 0; b < frames / TOOL_BLOCK_FRAMES; b++) {
+        for (size_t c = 0; c < BENCH_CHANNELS; c++)
+            memcpy(planes[c], signal[c] + b * TOOL_BLOCK_FRAMES, sizeof(float) * TOOL_BLOCK_FRAMES);
+        detector_process_gate(&gate, planes, BENCH_CHANNELS, TOOL_BLOCK_FRAMES);
+
+        for (size_t i = 0; i < TOOL_BLOCK_FRAMES; i++) {
+            float frame[BENCH_CHANNELS], *frame_planes[BENCH_CHANNELS];
+            for (size_t c = 0; c < BENCH_CHANNELS; c++) {
+                frame[c] = signal[c][b * TOOL_BLOCK_FRAMES + i];
+                frame_planes[c] = &frame[c];
+            }
+            detector_process(&ref, frame_planes, BENCH_CHANNELS, 1);
+            for (size_t c = 0; c < BENCH_CHANNELS; c++) {
+                double error = fabs((double)(frame[c] * ref.attenuation) - (double)planes[c][i]);
+                max_error = error > max_error ? error : max_error;
+            }
+        }
+    }
+    return max_error;
+}
+
+static void bench_gate(const struct bench_options *opt)
+{
+    const char *names[] = {"detect", "gate_then_detect", "combined"};
+    const size_t frames = (size_t)(opt->seconds * TOOL_DEFAULT_SAMPLE_RATE) / TOOL_BLOCK_FRAMES * TOOL_BLOCK_FRAMES;
+    float *signal[BENCH_CHANNELS], *planes[BENCH_CHANNELS];
+    uint32_t seed = 1;
+
+    for (size_t c = 0; c < BENCH_CHANNELS; c++) {
+        signal[c] = bmalloc(sizeof(float) * frames);
+        planes[c] = bmalloc(sizeof(float) * TOOL_BLOCK_FRAMES);
+    }
+    fill_talk(signal, BENCH_CHANNELS, frames, &seed);
+
+    printf("mode,block_ns\n");
+    for (int m = GATE_DETECT; m <= GATE_COMBINED; m++) {
+        printf("%s,%.0f\n", names[m], gate_block_ns((enum gate_mode)m, signal, frames, planes));
+        fflush(stdout);
+    }
+    fprintf(stderr, "combined max error vs per sample gating: %g\n", gate_max_error(signal, frames, planes));
+
+    for (size_t c = 0; c < BENCH_CHANNELS; c++) {
+        bfree(signal[c]);
+        bfree(planes[c]);
+    }
+}
+
+/* Block of the first notification for a burst of speech_sample frames long
+ * starting at frame onset, -1 if there was none
+ */
+static int64_t trigger_block(const struct detector_settings *settings, float **idle, size_t idle_blocks, size_t onset,
+                             size_t length, float **planes)
+{
+    struct detector d = {0};
+    size_t blocks = (onset + length) / TOOL_BLOCK_FRAMES + TOOL_DEFAULT_SAMPLE_RATE / TOOL_BLOCK_FRAMES;
+
+    detector_update(&d, settings, (float)TOOL_DEFAULT_SAMPLE_RATE);
+    for (size_t b = 0; b < blocks; b++) {
+        for (size_t c = 0; c < BENCH_CHANNELS; c++) {
+            const float *src = idle[c] + (b % idle_blocks) * TOOL_BLOCK_FRAMES;
+            for (size_t i = 0; i < TOOL_BLOCK_FRAMES; i++) {
+                size_t n = b * TOOL_BLOCK_FRAMES + i;
+                planes[c][i] = src[i] + (n >= onset && n < onset + length ? speech_sample(n - onset) : 0.0f);
+            }
+        }
+        detector_process(&d, planes, BENCH_CHANNELS, TOOL_BLOCK_FRAMES);
+        if (detector_check_trigger(&d, (uint64_t)b * TOOL_BLOCK_FRAMES * 1000 / TOOL_DEFAULT_SAMPLE_RATE, 0))
+            return (int64_t)b;
+    }
+    return -1;
+}
+
+static void bench_lookahead(const struct bench_options *opt)
+{
+    const size_t idle_blocks = 10 * TOOL_DEFAULT_SAMPLE_RATE / TOOL_BLOCK_FRAMES;
+    const size_t blocks = (size_t)(opt->seconds * TOOL_DEFAULT_SAMPLE_RATE / TOOL_BLOCK_FRAMES);
+    const double block_ms = (double)TOOL_BLOCK_FRAMES * 1000.0 / TOOL_DEFAULT_SAMPLE_RATE;
+    /* Clicks and coughs next to a word */
+    const size_t bursts_ms[] = {20, 50, 100};
+    const size_t speech_ms = 600;
+    const int trials = 50;
+    struct detector_settings settings;
+    float *talk[BENCH_CHANNELS], *idle[BENCH_CHANNELS], *planes[BENCH_CHANNELS];
+    uint32_t seed = 1;
+
+    tool_detector_defaults(&settings);
+    for (size_t c = 0; c < BENCH_CHANNELS; c++) {
+        talk[c] = bmalloc(sizeof(float) * TOOL_BLOCK_FRAMES * idle_blocks);
+        idle[c] = bmalloc(sizeof(float) * TOOL_BLOCK_FRAMES * idle_blocks);
+        planes[c] = bmalloc(sizeof(float) * TOOL_BLOCK_FRAMES);
+    }
+    fill_talk(talk, BENCH_CHANNELS, TOOL_BLOCK_FRAMES * idle_blocks, &seed);
+    fill_idle_noise(idle, BENCH_CHANNELS, TOOL_BLOCK_FRAMES * idle_blocks, &seed);
+
+    printf("lookahead,block_ns,speech_latency_ms,triggers_20ms,triggers_50ms,triggers_100ms\n");
+    for (int k = 0; k <= DETECTOR_MAX_LOOKAHEAD; k++) {
+        struct detector d = {0};
+        float *block[BENCH_CHANNELS];
+
+        settings.lookahead_blocks = k;
+        detector_update(&d, &settings, (float)TOOL_DEFAULT_SAMPLE_RATE);
+
+        uint64_t start = tool_thread_cpu_ns();
+        for (size_t b = 0; b < blocks; b++) {
+            for (size_t c = 0; c < BENCH_CHANNELS; c++)
+                block[c] = talk[c] + (b % idle_blocks) * TOOL_BLOCK_FRAMES;
+            detector_process(&d, block, BENCH_CHANNELS, TOOL_BLOCK_FRAMES);
+            detector_check_trigger(&d, (uint64_t)b * TOOL_BLOCK_FRAMES * 1000 / TOOL_DEFAULT_SAMPLE_RATE, 0);
+        }
+        double ns = blocks ? (double)(tool_thread_cpu_ns() - start) / (double)blocks : 0.0;
+
+        /* Time from the onset of a word to its notification, and how many
+         * short bursts get one
+         */
+        double latency = 0.0;
+        int detected = 0, triggers[3] = {0};
+        for (int t = 0; t < trials; t++) {
+            size_t onset = 2 * TOOL_DEFAULT_SAMPLE_RATE + ((size_t)t * 7919u) % (TOOL_DEFAULT_SAMPLE_RATE);
+            int64_t b = trigger_block(&settings, idle, idle_blocks, onset,
+                                      speech_ms * TOOL_DEFAULT_SAMPLE_RATE / 1000, planes);
+            if (b >= 0) {
+                latency += (double)(b + 1) * block_ms - (double)onset * 1000.0 / TOOL_DEFAULT_SAMPLE_RATE;
+                detected++;
+            }
+            for (size_t l = 0; l < 3; l++)
+                triggers[l] += trigger_block(&settings, idle, idle_blocks, onset,
+                                             bursts_ms[l] * TOOL_DEFAULT_SAMPLE_RATE / 1000, planes) >= 0;
+        }
+
+        printf("%d,%.0f,%.1f,%d,%d,%d\n", k, ns, detected ? latency / detected : -1.0, triggers[0], triggers[1],
+               triggers[2]);
+        fflush(stdout);
+    }
+    fprintf(stderr, "%d bursts of each length, latency of %zu ms words\n", trials, speech_ms);
+
+    for (size_t c = 0; c < BENCH_CHANNELS; c++) {
+        bfree(talk[c]);
+        bfree(idle[c]);
+        bfree(planes[c]);
+    }
+}
+
+/* Stand-in for a noise suppressor ahead of the filter: it holds the audio
+ * back by one 10 ms frame like RNNoise and silences anything under -50 dBFS
+ */
+#define SUPPRESSOR_FRAMES 480
+
+struct suppressor {
+    float delay[BENCH_CHANNELS][SUPPRESSOR_FRAMES];
+    size_t pos;
+};
+
+static void suppressor_process(struct suppressor *s, float **planes, size_t frames)
+{
+    for (size_t i = 0; i < frames; i++) {
+        for (size_t c = 0; c < BENCH_CHANNELS; c++) {
+            float in = planes[c][i];
+            planes[c][i] = s->delay[c][s->pos];
+            s->delay[c][s->pos] = fabsf(in) < 0.00316f ? 0.0f : in;
+        }
+        s->pos = (s->pos + 1) % SUPPRESSOR_FRAMES;
+    }
+}
+
+enum tap_case {
+    /* Filter tap with the filter above the suppressor */
+    TAP_CASE_FIRST,
+    /* Filter tap with the filter below the suppressor */
+    TAP_CASE_AFTER,
+    /* Capture callback tap, obs calls it after the whole chain */
+    TAP_CASE_OUTPUT,
+};
+
+typedef bool (*tap_fn)(struct detector *d, float **planes, uint64_t time_ms);
+
+/* What the filter does per block at either tap, called through a pointer
+ * like obs calls filter_audio and the capture callback
+ */
+static bool tap_analyze(struct detector *d, float **planes, uint64_t time_ms)
+{
+    detector_process(d, planes, BENCH_CHANNELS, TOOL_BLOCK_FRAMES);
+    return detector_check_trigger(d, time_ms, 0);
+}
+
+/* obs still calls filter_audio with the output tap, it returns right away */
+static bool tap_skip(struct detector *d, float **planes, uint64_t time_ms)
+{
+    UNUSED_PARAMETER(d);
+    UNUSED_PARAMETER(planes);
+    UNUSED_PARAMETER(time_ms);
+    return false;
+}
+
+/* Runs the source through the chain and returns the block of the first
+ * notification after frame onset, -1 if there was none. Only the filter's
+ * own work is added to analysis_ns, like the plugin's analysis cost log
+ */
+static int64_t tap_run(enum tap_case tap, const struct detector_settings *settings, float **source,
+                       size_t source_blocks, size_t blocks, size_t onset, float **planes, uint64_t *analysis_ns)
+{
+    volatile tap_fn filter = tap == TAP_CASE_OUTPUT ? tap_skip : tap_analyze;
+    volatile tap_fn capture = tap_analyze;
+    struct suppressor *s = bzalloc(sizeof(*s));
+    struct detector d = {0};
+    int64_t trigger = -1;
+
+    detector_update(&d, settings, (float)TOOL_DEFAULT_SAMPLE_RATE);
+    for (size_t b = 0; b < blocks; b++) {
+        uint64_t time_ms = (uint64_t)b * TOOL_BLOCK_FRAMES * 1000 / TOOL_DEFAULT_SAMPLE_RATE;
+        bool triggered = false;
+        uint64_t start;
+
+        for (size_t c = 0; c < BENCH_CHANNELS; c++) {
+            const float *src = source[c] + (b % source_blocks) * TOOL_BLOCK_FRAMES;
+            for (size_t i = 0; i < TOOL_BLOCK_FRAMES; i++) {
+                size_t n = b * TOOL_BLOCK_FRAMES + i;
+                planes[c][i] = src[i] + (onset && n >= onset ? speech_sample(n - onset) : 0.0f);
+            }
+        }
+
+        if (tap != TAP_CASE_FIRST)
+            suppressor_process(s, planes, TOOL_BLOCK_FRAMES);
+        start = os_gettime_ns();
+        triggered = filter(&d, planes, time_ms);
+        *analysis_ns += os_gettime_ns() - start;
+        if (tap == TAP_CASE_FIRST)
+            suppressor_process(s, planes, TOOL_BLOCK_FRAMES);
+        if (tap == TAP_CASE_OUTPUT) {
+            start = os_gettime_ns();
+            triggered = capture(&d, planes, time_ms);
+            *analysis_ns += os_gettime_ns() - start;
+        }
+
+        if (triggered && trigger < 0 && (b + 1) * TOOL_BLOCK_FRAMES > onset)
+            trigger = (int64_t)b;
+    }
+
+    bfree(s);
+    return trigger;
+}
+
+static void bench_tap(const struct bench_options *opt)
+{
+    const char *names[] = {"filter_first", "filter_after_suppressor", "output"};
+    const size_t idle_blocks = 10 * TOOL_DEFAULT_SAMPLE_RATE / TOOL_BLOCK_FRAMES;
+    const size_t blocks = (size_t)(opt->seconds * TOOL_DEFAULT_SAMPLE_RATE / TOOL_BLOCK_FRAMES);
+    const double block_ms = (double)TOOL_BLOCK_FRAMES * 1000.0 / TOOL_DEFAULT_SAMPLE_RATE;
+    const int trials = 50;
+    struct detector_settings settings;
+    float *talk[BENCH_CHANNELS], *idle[BENCH_CHANNELS], *planes[BENCH_CHANNELS];
+    uint32_t seed = 1;
+
+    tool_detector_defaults(&settings);
+    for (size_t c = 0; c < BENCH_CHANNELS; c++) {
+        talk[c] = bmalloc(sizeof(float) * TOOL_BLOCK_FRAMES * idle_blocks);
+        idle[c] = bmalloc(sizeof(float) * TOOL_BLOCK_FRAMES * idle_blocks);
+        planes[c] = bmalloc(sizeof(float) * TOOL_BLOCK_FRAMES);
+    }
+    fill_talk(talk, BENCH_CHANNELS, TOOL_BLOCK_FRAMES * idle_blocks, &seed);
+    fill_idle_noise(idle, BENCH_CHANNELS, TOOL_BLOCK_FRAMES * idle_blocks, &seed);
+
+    printf("tap,block_ns,speech_latency_ms\n");
+    for (int t = TAP_CASE_FIRST; t <= TAP_CASE_OUTPUT; t++) {
+        /* The trials are timed too but only the continuous run is reported */
+        uint64_t analysis_ns = 0, trial_ns = 0;
+        tap_run((enum tap_case)t, &settings, talk, idle_blocks, blocks, 0, planes, &analysis_ns);
+
+        /* Onset of a word to its notification, the suppressor's delay shows
+         * up for every tap below it
+         */
+        double latency = 0.0;
+        int detected = 0;
+        for (int i = 0; i < trials; i++) {
+            size_t onset = 2 * TOOL_DEFAULT_SAMPLE_RATE + ((size_t)i * 7919u) % (TOOL_DEFAULT_SAMPLE_RATE);
+            size_t run = onset / TOOL_BLOCK_FRAMES + TOOL_DEFAULT_SAMPLE_RATE / TOOL_BLOCK_FRAMES;
+            int64_t b = tap_run((enum tap_case)t, &settings, idle, idle_blocks, run, onset, planes, &trial_ns);
+            if (b >= 0) {
+                latency += (double)(b + 1) * block_ms - (double)onset * 1000.0 / TOOL_DEFAULT_SAMPLE_RATE;
+                detected++;
+            }
+        }
+
+        printf("%s,%.0f,%.1f\n", names[t], blocks ? (double)analysis_ns / (double)blocks : 0.0,
+               detected ? latency / detected : -1.0);
+        fflush(stdout);
+    }
+    fprintf(stderr, "suppressor delay %.1f ms, latency of %d word onsets\n",
+            (double)SUPPRESSOR_FRAMES * 1000.0 / TOOL_DEFAULT_SAMPLE_RATE, trials);
+
+    for (size_t c = 0; c < BENCH_CHANNELS; c++) {
+        bfree(talk[c]);
+        bfree(idle[c]);
+        bfree(planes[c]);
+    }
+}
+
+static double clip_read_ns(const struct clip *c, float *out, uint32_t frames, int iterations)
+{
+    uint64_t cursor = 0;
+    uint64_t start = os_gettime_ns();
+    for (int i = 0; i < iterations; i++) {
+        clip_read(c, cursor, out, ma_format_f32, frames);
+        cursor += frames;
+        if (cursor + frames > c->frames)
+            cursor = 0;
+    }
+    return (double)(os_gettime_ns() - start) / (double)iterations;
+}
+
+static void bench_clip(const struct bench_options *opt)
+{
+    /* The built-in sound is always f32, so compare on the shipped file */
+    const char *path = *opt->clip ? opt->clip : "data/urmuted.wav";
+    const uint32_t periods[] = {480, 1024};
+    const int iterations = opt->iterations * 10000;
+    struct clip f32 = {0}, s16 = {0};
+
+    if (!clip_load_file(&f32, path, ma_format_f32) || !clip_load_file(&s16, path, ma_format_s16)) {
+        fprintf(stderr, "Failed to load '%s'\n", path);
+        clip_free(&f32);
+        clip_free(&s16);
+        return;
+    }
+
+    printf("format,bytes,frames,period,ns_per_callback\n");
+    for (size_t i = 0; i < sizeof(periods) / sizeof(periods[0]); i++) {
+        uint32_t frames = periods[i];
+        if (frames > f32.frames)
+            continue;
+
+        float *out = bmalloc(sizeof(float) * frames * f32.channels);
+        printf("f32,%zu,%llu,%u,%.1f\n", clip_size(&f32), (unsigned long long)f32.frames, frames,
+               clip_read_ns(&f32, out, frames, iterations));
+        printf("s16,%zu,%llu,%u,%.1f\n", clip_size(&s16), (unsigned long long)s16.frames, frames,
+               clip_read_ns(&s16, out, frames, iterations));
+        bfree(out);
+    }
+
+    clip_free(&f32);
+    clip_free(&s16);
+}
+
+static bool parse_counts(const char *arg, struct bench_options *opt)
+{
+    const char *c = arg;
+    opt->counts.num = 0;
+    while (*c) {
+        char *end;
+        int v = (int)strtol(c, &end, 10);
+        if (end == c || v <= 0)
+            return false;
+        da_push_back(opt->counts, &v);
+        c = *end == ',' ? end + 1 : end;
+    }
+    return opt->counts.num > 0;
+}
+
+static bool parse_priority(const char *arg, ma_thread_priority *priority)
+{
+    if (strcmp(arg, "normal") == 0)
+        *priority = ma_thread_priority_normal;
+    else if (strcmp(arg, "high") == 0)
+        *priority = ma_thread_priority_high;
+    else if (strcmp(arg, "highest") == 0)
+        *priority = ma_thread_priority_highest;
+    else if (strcmp(arg, "realtime") == 0)
+        *priority = ma_thread_priority_realtime;
+    else
+        return false;
+    return true;
+}
+
+static void print_usage(const char *name)
+{
+    printf("Usage: %s <benchmark> [options]\n\n"
+           "Benchmarks:\n"
+           "  instances   create N filter instances on the null backend and report create time,\n"
+           "              audio thread cpu per block, resident memory, threads and destroy time\n"
+           "  startup     time each phase of creating one instance (context, decode, device)\n"
+           "  recycle     destroy and recreate N instances like a scene collection switch,\n"
+           "              with and without the recycling pool\n"
+           "  clip        memory and callback cost of f32 and compact s16 clip storage\n"
+           "  thread      scheduling class the playback callback thread ends up with\n"
+           "  prewarm     time until a notification starts playing on a stopped device and on\n"
+           "              one that was prepared ahead of time\n"
+           "  scan        detector cpu per block on idle mic noise and the detection delay\n"
+           "              of speech onsets for full and sparse scanning\n"
+           "  gate        cpu per block of detection alone, a noise gate followed by detection\n"
+           "              and both in one pass\n"
+           "  lookahead   cpu per block, notification latency of words and notifications for\n"
+           "              short bursts for every lookahead\n"
+           "  tap         cpu per block and notification latency of the filter tap above and\n"
+           "              below a noise suppressor and of the output tap\n\n"
+           "Options:\n"
+           "  --counts <n,...>   instance counts (default 1,10,100,500)\n"
+           "  --seconds <s>      audio simulated per count (default 10)\n"
+           "  --jobs <n>         setup threads for instances, 0 = one per core like the plugin\n"
+           "                     (default 1, on the calling thread)\n"
+           "  --clip <file>      notification sound to load (default: the built-in sound,\n"
+           "                     data/urmuted.wav for clip)\n"
+           "  --iterations <n>   startup and prewarm repetitions, x10000 callbacks for clip\n"
+           "                     (default 20)\n"
+           "  --system           use the system's audio backends instead of the null backend\n"
+           "  --device <name>    device to open with --system\n"
+           "  --priority <p>     playback thread priority for thread: normal, high, highest\n"
+           "                     (default) or realtime\n"
+           "  --affinity <cpus>  cpus the playback thread is pinned to for thread, e.g. 0,2-3\n",
+           name);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_options opt = {0};
+    int ret = 0;
+
+    da_init(opt.counts);
+    opt.seconds = 10.0;
+    opt.iterations = 20;
+    opt.jobs = 1;
+    opt.clip = "";
+
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    for (int i = 2; i < argc; i++) {
+        const char *arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (strcmp(arg, "--counts") == 0 && has_value) {
+            if (!parse_counts(argv[++i], &opt)) {
+                fprintf(stderr, "Invalid counts '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(arg, "--seconds") == 0 && has_value) {
+            opt.seconds = atof(argv[++i]);
+        } else if (strcmp(arg, "--jobs") == 0 && has_value) {
+            opt.jobs = atoi(argv[++i]);
+        } else if (strcmp(arg, "--clip") == 0 && has_value) {
+            opt.clip = argv[++i];
+        } else if (strcmp(arg, "--iterations") == 0 && has_value) {
+            opt.iterations = atoi(argv[++i]);
+        } else if (strcmp(arg, "--system") == 0) {
+            opt.system_backend = true;
+        } else if (strcmp(arg, "--device") == 0 && has_value) {
+            opt.device = argv[++i];
+        } else if (strcmp(arg, "--priority") == 0 && has_value) {
+            if (!parse_priority(argv[++i], &opt.priority)) {
+                fprintf(stderr, "Invalid priority '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(arg, "--affinity") == 0 && has_value) {
+            if (!thread_parse_affinity(argv[++i], &opt.affinity)) {
+                fprintf(stderr, "Invalid cpu list '%s'\n", argv[i]);
+                return 1;
+            }
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!opt.counts.num)
+        parse_counts("1,10,100,500", &opt);
+
+    if (opt.jobs < 0)
+        opt.jobs = 1;
+
+    if (opt.iterations < 1)
+        opt.iterations = 1;
+
+    if (strcmp(argv[1], "instances") == 0) {
+        bench_instances(&opt);
+    } else if (strcmp(argv[1], "startup") == 0) {
+        bench_startup(&opt);
+    } else if (strcmp(argv[1], "recycle") == 0) {
+        bench_recycle(&opt);
+    } else if (strcmp(argv[1], "clip") == 0) {
+        bench_clip(&opt);
+    } else if (strcmp(argv[1], "thread") == 0) {
+        bench_thread(&opt);
+    } else if (strcmp(argv[1], "prewarm") == 0) {
+        bench_prewarm(&opt);
+    } else if (strcmp(argv[1], "scan") == 0) {
+        bench_scan(&opt);
+    } else if (strcmp(argv[1], "gate") == 0) {
+        bench_gate(&opt);
+    } else if (strcmp(argv[1], "lookahead") == 0) {
+        bench_lookahead(&opt);
+    } else if (strcmp(argv[1], "tap") == 0) {
+        bench_tap(&opt);
+    } else {
+        print_usage(argv[0]);
+        ret = 1;
+    }
+
+    da_free(opt.counts);
+    return ret;
+}
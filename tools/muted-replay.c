@@ -0,0 +1,173 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/**
+ * Streams recorded audio through the filter's detector as fast as possible,
+ * one file per worker, and prints when notifications would have been played.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/bmem.h>
+#include <util/darray.h>
+#include <util/platform.h>
+
+#include "task-pool.h"
+#include "tool-common.h"
+
+struct replay_job {
+    const char *path;
+    const struct detector_settings *settings;
+    uint32_t sample_rate;
+    uint64_t clip_length_ms;
+
+    bool ok;
+    DARRAY(uint64_t) triggers;
+    uint64_t frames;
+    uint64_t open_blocks;
+    uint64_t blocks;
+    /* Cpu time of the worker thread, decoding included */
+    uint64_t cpu_ns;
+    uint32_t file_sample_rate;
+};
+
+static void replay_file(void *param)
+{
+    struct replay_job *job = param;
+    struct tool_stream stream;
+    struct detector detector = {0};
+    uint64_t start = tool_thread_cpu_ns();
+    size_t read;
+
+    if (!tool_stream_open(&stream, job->path, job->sample_rate))
+        return;
+
+    job->file_sample_rate = stream.sample_rate;
+    detector_update(&detector, job->settings, (float)stream.sample_rate);
+
+    while ((read = tool_stream_read(&stream)) > 0) {
+        job->frames += read;
+        job->blocks++;
+        if (detector_process(&detector, stream.planes, stream.channels, read))
+            job->open_blocks++;
+
+        uint64_t time = job->frames * 1000 / stream.sample_rate;
+        if (detector_check_trigger(&detector, time, job->clip_length_ms))
+            da_push_back(job->triggers, &time);
+    }
+
+    tool_stream_close(&stream);
+    job->cpu_ns = tool_thread_cpu_ns() - start;
+    job->ok = true;
+}
+
+static void print_usage(const char *name)
+{
+    printf("Usage: %s [options] <file>...\n"
+           "Runs audio files through the muted notification detector in %i frame blocks.\n\n"
+           "Options:\n"
+           "  -j, --jobs <n>          worker threads (default: logical cores)\n"
+           "  --rate <hz>             resample to this rate before analysis (default %i)\n"
+           "  --clip-length <ms>      notification length added to the cooldown (default 0)\n",
+           name, TOOL_BLOCK_FRAMES, TOOL_DEFAULT_SAMPLE_RATE);
+    tool_print_detector_usage();
+}
+
+int main(int argc, char **argv)
+{
+    struct detector_settings settings;
+    DARRAY(struct replay_job) jobs;
+    uint32_t sample_rate = TOOL_DEFAULT_SAMPLE_RATE;
+    uint64_t clip_length_ms = 0;
+    size_t threads = 0;
+    int failed = 0;
+
+    da_init(jobs);
+    tool_detector_defaults(&settings);
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (tool_parse_detector_arg(argc, argv, &i, &settings)) {
+            continue;
+        } else if ((strcmp(arg, "-j") == 0 || strcmp(arg, "--jobs") == 0) && has_value) {
+            threads = (size_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--rate") == 0 && has_value) {
+            sample_rate = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--clip-length") == 0 && has_value) {
+            clip_length_ms = (uint64_t)atoll(argv[++i]);
+        } else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0 || arg[0] == '-') {
+            print_usage(argv[0]);
+            return arg[0] == '-' && arg[1] != 'h' && strcmp(arg, "--help") != 0;
+        } else {
+            struct replay_job job = {0};
+            job.path = arg;
+            da_push_back(jobs, &job);
+        }
+    }
+
+    if (!jobs.num) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    struct task_pool *pool = task_pool_create(threads, "muted-replay");
+    uint64_t start = os_gettime_ns();
+
+    for (size_t i = 0; i < jobs.num; i++) {
+        jobs.array[i].settings = &settings;
+        jobs.array[i].sample_rate = sample_rate;
+        jobs.array[i].clip_length_ms = clip_length_ms;
+        task_pool_push(pool, replay_file, &jobs.array[i]);
+    }
+    task_pool_wait(pool);
+
+    uint64_t wall_ns = os_gettime_ns() - start;
+    double total_audio = 0.0;
+
+    for (size_t i = 0; i < jobs.num; i++) {
+        struct replay_job *job = &jobs.array[i];
+        if (!job->ok) {
+            printf("%s: failed\n", job->path);
+            failed++;
+            continue;
+        }
+
+        double seconds = (double)job->frames / (double)job->file_sample_rate;
+        double cpu = (double)job->cpu_ns / 1e9;
+        total_audio += seconds;
+
+        for (size_t j = 0; j < job->triggers.num; j++)
+            printf("%s: trigger at %.3f s\n", job->path, (double)job->triggers.array[j] / 1000.0);
+
+        printf("%s: %.1f s audio, %i triggers, gate open in %.1f%% of blocks, %.3f s cpu (%.0fx realtime)\n",
+               job->path, seconds, (int)job->triggers.num,
+               job->blocks ? 100.0 * (double)job->open_blocks / (double)job->blocks : 0.0, cpu,
+               cpu > 0.0 ? seconds / cpu : 0.0);
+        da_free(job->triggers);
+    }
+
+    double wall = (double)wall_ns / 1e9;
+    printf("total: %i files (%i failed), %.1f s audio in %.3f s on %i threads (%.0fx realtime)\n", (int)jobs.num,
+           failed, total_audio, wall, (int)task_pool_thread_count(pool), wall > 0.0 ? total_audio / wall : 0.0);
+
+    task_pool_destroy(pool);
+    da_free(jobs);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,309 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/**
+ * Sums up the talk log the filter writes to its config directory
+ * (talk-log.csv) per source and day, week or in total.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <util/bmem.h>
+#include <util/darray.h>
+
+#define DAY 86400
+
+enum period { PERIOD_DAY, PERIOD_WEEK, PERIOD_TOTAL };
+
+struct entry {
+    int64_t start;
+    char *source;
+    uint64_t talk_ms;
+    uint64_t notifications;
+    uint64_t hash;
+};
+
+struct report {
+    enum period period;
+    int64_t since, until;
+
+    /* Open addressing over entries, indices + 1 so 0 is an empty bucket */
+    DARRAY(struct entry) entries;
+    size_t *buckets;
+    size_t bucket_count;
+};
+
+/* Days since 1970-01-01 for a proleptic gregorian date, works without timegm */
+static int64_t days_from_civil(int64_t y, int m, int d)
+{
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static bool parse_date(const char *str, int64_t *out)
+{
+    int y, m, d;
+    if (sscanf(str, "%d-%d-%d", &y, &m, &d) != 3 || m < 1 || m > 12 || d < 1 || d > 31)
+        return false;
+    *out = days_from_civil(y, m, d) * DAY;
+    return true;
+}
+
+static void format_date(int64_t t, char *out, size_t size)
+{
+    time_t tt = (time_t)t;
+    struct tm *tm = gmtime(&tt);
+    if (tm)
+        strftime(out, size, "%Y-%m-%d", tm);
+    else
+        snprintf(out, size, "%lld", (long long)t);
+}
+
+static int64_t period_start(enum period period, int64_t t)
+{
+    int64_t day = (t >= 0 ? t / DAY : (t - DAY + 1) / DAY);
+
+    switch (period) {
+    case PERIOD_DAY:
+        return day * DAY;
+    case PERIOD_WEEK:
+        /* 1970-01-01 was a thursday, weeks start on monday */
+        return (day - ((day + 3) % 7 + 7) % 7) * DAY;
+    default:
+        return 0;
+    }
+}
+
+static uint64_t hash_entry(int64_t start, const char *source)
+{
+    uint64_t h = 14695981039346656037ULL ^ (uint64_t)start;
+    for (const char *c = source; *c; c++)
+        h = (h ^ (uint8_t)*c) * 1099511628211ULL;
+    return h;
+}
+
+static void rehash(struct report *r, size_t count)
+{
+    bfree(r->buckets);
+    r->buckets = bzalloc(sizeof(size_t) * count);
+    r->bucket_count = count;
+    for (size_t i = 0; i < r->entries.num; i++) {
+        size_t b = (size_t)(r->entries.array[i].hash & (count - 1));
+        while (r->buckets[b])
+            b = (b + 1) & (count - 1);
+        r->buckets[b] = i + 1;
+    }
+}
+
+static void add_row(struct report *r, int64_t time, const char *source, uint64_t talk_ms, uint64_t notifications)
+{
+    int64_t start = period_start(r->period, time);
+    uint64_t hash = hash_entry(start, source);
+    size_t b = (size_t)(hash & (r->bucket_count - 1));
+
+    for (; r->buckets[b]; b = (b + 1) & (r->bucket_count - 1)) {
+        struct entry *e = &r->entries.array[r->buckets[b] - 1];
+        if (e->hash == hash && e->start == start && strcmp(e->source, source) == 0) {
+            e->talk_ms += talk_ms;
+            e->notifications += notifications;
+            return;
+        }
+    }
+
+    struct entry *e = da_push_back_new(r->entries);
+    e->start = start;
+    e->source = bstrdup(source);
+    e->talk_ms = talk_ms;
+    e->notifications = notifications;
+    e->hash = hash;
+    r->buckets[b] = r->entries.num;
+
+    if (r->entries.num * 2 > r->bucket_count)
+        rehash(r, r->bucket_count * 2);
+}
+
+/* Splits one row in place, the source is unquoted with "" turned into " */
+static bool parse_row(char *line, int64_t *time, char **source, uint64_t *talk_ms, uint64_t *notifications)
+{
+    char *c = line, *end, *out;
+
+    *time = strtoll(c, &end, 10);
+    if (end == c || *end != ',')
+        return false;
+    c = end + 1;
+
+    if (*c != '"')
+        return false;
+    *source = out = ++c;
+    for (;;) {
+        if (!*c)
+            return false;
+        if (*c == '"') {
+            if (c[1] != '"')
+                break;
+            c++;
+        }
+        *out++ = *c++;
+    }
+    *out = 0;
+    c++;
+
+    if (*c != ',')
+        return false;
+    *talk_ms = strtoull(c + 1, &end, 10);
+    if (*end != ',')
+        return false;
+    c = end + 1;
+    *notifications = strtoull(c, &end, 10);
+    return end != c;
+}
+
+static bool read_log(struct report *r, const char *path)
+{
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    char line[4096];
+    size_t line_number = 0, skipped = 0;
+
+    if (!f) {
+        fprintf(stderr, "Failed to open '%s'\n", path);
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        int64_t time;
+        char *source;
+        uint64_t talk_ms, notifications;
+
+        if (line_number++ == 0 && strncmp(line, "time,", 5) == 0)
+            continue;
+        if (!parse_row(line, &time, &source, &talk_ms, &notifications)) {
+            skipped++;
+            continue;
+        }
+        if (time < r->since || time >= r->until)
+            continue;
+        add_row(r, time, source, talk_ms, notifications);
+    }
+
+    if (skipped)
+        fprintf(stderr, "%s: skipped %zu malformed rows\n", path, skipped);
+    if (f != stdin)
+        fclose(f);
+    return true;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const struct entry *ea = a, *eb = b;
+    if (ea->start != eb->start)
+        return ea->start < eb->start ? -1 : 1;
+    return strcmp(ea->source, eb->source);
+}
+
+static void print_usage(const char *name)
+{
+    printf("Usage: %s [options] <talk-log.csv|->...\n\n"
+           "Options:\n"
+           "  --by <day|week|total>  period to sum over (default week, weeks start on monday)\n"
+           "  --since <YYYY-MM-DD>   ignore rows before this day\n"
+           "  --until <YYYY-MM-DD>   ignore rows from this day on\n\n"
+           "Prints period,source,talk_s,notifications, days are in UTC.\n",
+           name);
+}
+
+int main(int argc, char **argv)
+{
+    struct report r = {0};
+    DARRAY(const char *) files;
+    int ret = 0;
+
+    da_init(files);
+    da_init(r.entries);
+    r.period = PERIOD_WEEK;
+    r.since = INT64_MIN;
+    r.until = INT64_MAX;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (strcmp(arg, "--by") == 0 && has_value) {
+            const char *v = argv[++i];
+            if (strcmp(v, "day") == 0)
+                r.period = PERIOD_DAY;
+            else if (strcmp(v, "week") == 0)
+                r.period = PERIOD_WEEK;
+            else if (strcmp(v, "total") == 0)
+                r.period = PERIOD_TOTAL;
+            else
+                goto usage;
+        } else if (strcmp(arg, "--since") == 0 && has_value) {
+            if (!parse_date(argv[++i], &r.since))
+                goto usage;
+        } else if (strcmp(arg, "--until") == 0 && has_value) {
+            if (!parse_date(argv[++i], &r.until))
+                goto usage;
+        } else if (arg[0] == '-' && arg[1]) {
+            goto usage;
+        } else {
+            da_push_back(files, &arg);
+        }
+    }
+
+    if (!files.num)
+        goto usage;
+
+    rehash(&r, 64);
+    for (size_t i = 0; i < files.num; i++) {
+        if (!read_log(&r, files.array[i]))
+            ret = 1;
+    }
+
+    qsort(r.entries.array, r.entries.num, sizeof(struct entry), compare_entries);
+    printf("period,source,talk_s,notifications\n");
+    for (size_t i = 0; i < r.entries.num; i++) {
+        const struct entry *e = &r.entries.array[i];
+        char period[32] = "total";
+
+        if (r.period != PERIOD_TOTAL)
+            format_date(e->start, period, sizeof(period));
+        printf("%s,\"", period);
+        for (const char *c = e->source; *c; c++) {
+            if (*c == '"')
+                putchar('"');
+            putchar(*c);
+        }
+        printf("\",%.1f,%llu\n", (double)e->talk_ms / 1000.0, (unsigned long long)e->notifications);
+        bfree(e->source);
+    }
+
+    da_free(r.entries);
+    bfree(r.buckets);
+    da_free(files);
+    return ret;
+
+usage:
+    print_usage(argv[0]);
+    da_free(files);
+    return 1;
+}
@@ -0,0 +1,385 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/**
+ * Stress test for the filter's threading: one thread changes settings the way
+ * muted_update does (file and device switches, slider sweeps), one runs audio
+ * blocks through the detector and triggers playback like muted_filter_audio,
+ * while miniaudio's null backend runs the playback callback. Another thread
+ * adds, renames and removes sources in the registry while one more reads
+ * every slot like muted_notification_get_state, and a log prefix is swapped
+ * and freed through the reaper while it's being read like in log_callback.
+ * One thread triggers a second, never reconfigured playback several times per
+ * clip length, so all of its voices are busy and the oldest gets stolen, and
+ * a last one keeps creating and destroying a third, handing its device and
+ * sound to the recycling pool and back. Build with ENABLE_TSAN to have
+ * ThreadSanitizer check every access. Fails on a torn read or if no voice was
+ * ever stolen.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#include "atomic-ptr.h"
+#include "playback.h"
+#include "reaper.h"
+#include "recycle.h"
+#include "registry.h"
+#include "tool-common.h"
+
+#define STRESS_CHANNELS 2
+#define NULL_DEVICE "NULL Playback Device"
+#define STRESS_SOURCES 100
+#define STRESS_NAME_LENGTH 100
+/* Short enough that some pooled items expire while others get taken */
+#define STRESS_GRACE_MS 20
+/* Notifications per clip length on the voice pool's device, enough to keep
+ * every voice busy and steal the oldest
+ */
+#define STRESS_PLAYS_PER_CLIP (PLAYBACK_VOICES * 2)
+/* How long the voices get to play out before they're counted */
+#define STRESS_DRAIN_MS 5000
+
+struct stress {
+    struct detector detector;
+    struct playback playback;
+    /* Never reconfigured or stopped, so its voices fill up */
+    struct playback voices;
+    struct registry_slot *slot;
+    char *volatile log_name;
+    const char *clips[3];
+    double seconds;
+    volatile bool stop;
+    volatile bool prepare_requested;
+
+    long updates;
+    long blocks;
+    long triggers;
+    long prepares;
+    long renames;
+    long reads;
+    long torn_reads;
+    long recycles;
+    long voice_plays;
+};
+
+static const ma_backend null_backend = ma_backend_null;
+
+static void stress_log(void *param, ma_uint32 level, const char *message)
+{
+    UNUSED_PARAMETER(param);
+    if (level <= MA_LOG_LEVEL_WARNING)
+        fprintf(stderr, "miniaudio: %s", message);
+}
+
+static void *audio_thread(void *param)
+{
+    struct stress *s = param;
+    float *planes[STRESS_CHANNELS];
+    uint32_t seed = 1;
+
+    os_set_thread_name("stress-audio");
+    for (size_t c = 0; c < STRESS_CHANNELS; c++)
+        planes[c] = bmalloc(sizeof(float) * TOOL_BLOCK_FRAMES);
+
+    while (!os_atomic_load_bool(&s->stop)) {
+        /* Cycle through speech bursts, silence and a level around the
+         * thresholds, so the gate keeps opening and the device gets prepared
+         */
+        const float amplitudes[] = {0.0005f, 0.5f, 0.05f};
+        float amplitude = amplitudes[(s->blocks / 8) % 3];
+        for (size_t c = 0; c < STRESS_CHANNELS; c++) {
+            for (size_t i = 0; i < TOOL_BLOCK_FRAMES; i++) {
+                seed = seed * 1664525u + 1013904223u;
+                planes[c][i] = ((float)(seed >> 8) / 16777216.0f - 0.5f) * amplitude;
+            }
+        }
+
+        detector_process(&s->detector, planes, STRESS_CHANNELS, TOOL_BLOCK_FRAMES);
+        /* No clip length or cooldown, so every opening triggers while the
+         * ui thread switches files and devices underneath
+         */
+        uint64_t time = os_gettime_ns() / 1000000;
+        /* Picked up by the ui thread, like the setup task does them */
+        if (s->detector.approaching)
+            os_atomic_set_bool(&s->prepare_requested, true);
+        bool triggered = detector_check_trigger(&s->detector, time, 0);
+        if (triggered) {
+            playback_play(&s->playback);
+            s->triggers++;
+        }
+        registry_publish(s->slot, TOOL_BLOCK_FRAMES, s->detector.is_open, triggered, time);
+        s->blocks++;
+        os_sleep_ms(1);
+    }
+
+    for (size_t c = 0; c < STRESS_CHANNELS; c++)
+        bfree(planes[c]);
+    return NULL;
+}
+
+static void *voices_thread(void *param)
+{
+    struct stress *s = param;
+
+    os_set_thread_name("stress-voices");
+
+    while (!os_atomic_load_bool(&s->stop)) {
+        uint64_t length_ms = playback_file_length(&s->voices);
+        playback_play(&s->voices);
+        s->voice_plays++;
+        os_sleep_ms((uint32_t)(length_ms / STRESS_PLAYS_PER_CLIP) + 1);
+    }
+    return NULL;
+}
+
+static void *ui_thread(void *param)
+{
+    struct stress *s = param;
+    struct detector_settings settings;
+
+    os_set_thread_name("stress-ui");
+    tool_detector_defaults(&settings);
+    settings.cooldown_ms = 0;
+
+    while (!os_atomic_load_bool(&s->stop)) {
+        long n = s->updates++;
+
+        /* Slider sweep */
+        settings.open_threshold_db = -40.0f + (float)(n % 30);
+        settings.close_threshold_db = settings.open_threshold_db - 6.0f;
+        settings.attack_time_ms = (int)(n % 50);
+        settings.hold_time_ms = (int)(n % 400);
+        settings.release_time_ms = 1 + (int)(n % 300);
+        settings.lookahead_blocks = (int)(n % 3);
+        detector_post_update(&s->detector, &settings, (float)TOOL_DEFAULT_SAMPLE_RATE);
+
+        /* File and device switches, including a device that doesn't exist */
+        struct playback_settings ps = {
+            .path = s->clips[(n / 4) % 3],
+            .device = (n / 7) % 3 == 2 ? "missing device" : NULL_DEVICE,
+            .compact = (n / 5) % 2 == 1,
+        };
+        playback_update(&s->playback, &ps);
+        if (os_atomic_set_bool(&s->prepare_requested, false)) {
+            playback_prepare(&s->playback);
+            s->prepares++;
+        }
+        /* Idle device stops like the setup task does them */
+        if (n % 3 == 0)
+            playback_release_idle(&s->playback, 0);
+
+        os_sleep_ms((uint32_t)(n % 3));
+    }
+    return NULL;
+}
+
+/* Names are one letter repeated, so a torn read shows up as a mixed name */
+static void set_test_name(struct registry_slot *slot, long n)
+{
+    char name[STRESS_NAME_LENGTH + 1];
+    memset(name, 'a' + (int)(n % 26), STRESS_NAME_LENGTH);
+    name[STRESS_NAME_LENGTH] = 0;
+    registry_set_name(slot, name);
+}
+
+static bool is_test_name(const char *name)
+{
+    /* A freshly acquired slot has no name yet */
+    if (!*name)
+        return true;
+    for (size_t i = 0; i < STRESS_NAME_LENGTH; i++) {
+        if (name[i] != name[0])
+            return false;
+    }
+    return name[STRESS_NAME_LENGTH] == 0;
+}
+
+static void *sources_thread(void *param)
+{
+    struct stress *s = param;
+    struct registry_slot *slots[STRESS_SOURCES] = {0};
+
+    os_set_thread_name("stress-sources");
+
+    while (!os_atomic_load_bool(&s->stop)) {
+        long n = s->renames++;
+        size_t i = (size_t)(n * 7) % STRESS_SOURCES;
+
+        /* Sources being added and removed, and the audio source being renamed */
+        if (slots[i]) {
+            registry_release(slots[i]);
+            slots[i] = NULL;
+        } else {
+            slots[i] = registry_acquire(TOOL_DEFAULT_SAMPLE_RATE);
+            set_test_name(slots[i], n);
+        }
+        set_test_name(s->slot, n);
+
+        char *name = bstrdup("source");
+        name[0] = 'a' + (char)(n % 26);
+        reaper_retire(bfree, atomic_ptr_exchange((void *volatile *)&s->log_name, name));
+        os_sleep_ms((uint32_t)(n % 2));
+    }
+
+    for (size_t i = 0; i < STRESS_SOURCES; i++)
+        registry_release(slots[i]);
+    return NULL;
+}
+
+static void *recycle_thread(void *param)
+{
+    struct stress *s = param;
+
+    os_set_thread_name("stress-recycle");
+
+    while (!os_atomic_load_bool(&s->stop)) {
+        struct playback p = {0};
+        long n = s->recycles++;
+
+        /* Filters being destroyed and created again, like on a scene collection switch */
+        if (!playback_init(&p, &null_backend, 1, stress_log, s))
+            break;
+        struct playback_settings ps = {.path = s->clips[n % 3], .device = NULL_DEVICE};
+        playback_update(&p, &ps);
+        if (n % 4 == 0)
+            playback_play(&p);
+        playback_free(&p);
+        os_sleep_ms((uint32_t)(n % 3) * 10);
+    }
+    return NULL;
+}
+
+static void *reader_thread(void *param)
+{
+    struct stress *s = param;
+    struct registry_state state;
+
+    os_set_thread_name("stress-reader");
+
+    while (!os_atomic_load_bool(&s->stop)) {
+        size_t capacity = registry_capacity();
+        for (size_t i = 0; i < capacity; i++) {
+            if (!registry_read(registry_slot_at(i), &state))
+                continue;
+            if (!is_test_name(state.name))
+                s->torn_reads++;
+            s->reads++;
+        }
+
+        long epoch = reaper_enter();
+        const char *name = atomic_ptr_load((void *volatile *)&s->log_name);
+        if (strcmp(name + 1, "ource") != 0)
+            s->torn_reads++;
+        reaper_exit(epoch);
+        os_sleep_ms(1);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    struct stress s = {0};
+    pthread_t audio, voices, ui, sources, reader, recycler;
+    char alt_clip[512];
+
+    s.clips[0] = "data/urmuted.wav";
+    s.seconds = 10.0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--clip") == 0 && i + 1 < argc) {
+            s.clips[0] = argv[++i];
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            s.seconds = atof(argv[++i]);
+        } else {
+            printf("Usage: %s [--clip <file>] [--seconds <s>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    /* Same file under a different path, so switching between them reloads,
+     * and the built-in sound
+     */
+    snprintf(alt_clip, sizeof(alt_clip), "%s%s", s.clips[0][0] == '/' ? "/." : "./", s.clips[0]);
+    s.clips[1] = alt_clip;
+    s.clips[2] = "";
+
+    registry_init();
+    recycle_start(STRESS_GRACE_MS);
+    reaper_start();
+    s.log_name = bstrdup("source");
+    s.slot = registry_acquire(TOOL_DEFAULT_SAMPLE_RATE);
+    detector_init(&s.detector);
+    if (!playback_init(&s.playback, &null_backend, 1, stress_log, &s))
+        return 1;
+    struct playback_settings ps = {.path = s.clips[0], .device = NULL_DEVICE};
+    playback_update(&s.playback, &ps);
+    if (!playback_init(&s.voices, &null_backend, 1, stress_log, &s))
+        return 1;
+    playback_update(&s.voices, &ps);
+
+    pthread_create(&audio, NULL, audio_thread, &s);
+    pthread_create(&voices, NULL, voices_thread, &s);
+    pthread_create(&ui, NULL, ui_thread, &s);
+    pthread_create(&sources, NULL, sources_thread, &s);
+    pthread_create(&reader, NULL, reader_thread, &s);
+    pthread_create(&recycler, NULL, recycle_thread, &s);
+
+    os_sleep_ms((uint32_t)(s.seconds * 1000.0));
+    os_atomic_set_bool(&s.stop, true);
+
+    pthread_join(ui, NULL);
+    pthread_join(audio, NULL);
+    pthread_join(voices, NULL);
+    pthread_join(sources, NULL);
+    pthread_join(reader, NULL);
+    pthread_join(recycler, NULL);
+
+    for (uint32_t waited = 0; playback_is_playing(&s.voices) && waited < STRESS_DRAIN_MS; waited += 10)
+        os_sleep_ms(10);
+
+    /* Every notification either started a voice, once, or was dropped */
+    struct playback_stats stats;
+    playback_get_stats(&s.voices, &stats);
+    long voice_starts = (long)stats.warm_starts + (long)stats.cold_starts;
+    bool voices_lost = s.voice_plays != voice_starts + (long)stats.dropped;
+    playback_free(&s.voices);
+    playback_free(&s.playback);
+    detector_free(&s.detector);
+
+    registry_release(s.slot);
+    registry_free();
+    reaper_stop();
+    recycle_stop();
+    bfree(s.log_name);
+
+    printf("%ld updates, %ld blocks, %ld triggers, %ld prepares\n", s.updates, s.blocks, s.triggers, s.prepares);
+    printf("%ld voice plays, %ld starts, %u steals, %u dropped\n", s.voice_plays, voice_starts, stats.steals,
+           stats.dropped);
+    printf("%ld renames, %ld registry reads, %ld torn\n", s.renames, s.reads, s.torn_reads);
+    printf("%ld playbacks recycled\n", s.recycles);
+    /* Without steals the voice pool's contended path never ran */
+    if (!stats.steals)
+        fprintf(stderr, "No voice was stolen, the pool wasn't saturated\n");
+    if (voices_lost)
+        fprintf(stderr, "Voice plays don't add up to starts and drops\n");
+    return s.torn_reads || !stats.steals || voices_lost ? 1 : 0;
+}
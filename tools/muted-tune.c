@@ -0,0 +1,448 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/**
+ * Grid search over the detector settings against recordings with labeled
+ * speech regions. Every file is decoded and reduced to per frame peaks once,
+ * all grid points then run the detector on that shared data in parallel.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/bmem.h>
+#include <util/darray.h>
+#include <util/platform.h>
+
+#include "task-pool.h"
+#include "tool-common.h"
+
+/* Settings searched over: thresholds, times, cooldown and lookahead */
+#define TUNE_AXES 7
+
+struct region {
+    uint64_t start_ms;
+    uint64_t end_ms;
+};
+
+struct tune_file {
+    const char *path;
+    float *peaks;
+    size_t frames;
+    uint32_t sample_rate;
+    DARRAY(struct region) regions;
+    bool ok;
+};
+
+struct tune_result {
+    uint32_t triggers;
+    uint32_t true_positives;
+    uint32_t regions_hit;
+    uint32_t regions;
+    double latency_sum_ms;
+};
+
+struct tune_point {
+    struct detector_settings settings;
+    struct tune_result total;
+    struct tune_result *per_file;
+};
+
+struct tune_ctx {
+    struct tune_file *files;
+    size_t file_count;
+    uint32_t sample_rate;
+    uint64_t clip_length_ms;
+    uint64_t tolerance_ms;
+};
+
+struct tune_job {
+    struct tune_ctx *ctx;
+    struct tune_point *point;
+    struct tune_file *file;
+};
+
+typedef DARRAY(float) float_list_t;
+
+static int compare_regions(const void *a, const void *b)
+{
+    const struct region *ra = a, *rb = b;
+    return ra->start_ms < rb->start_ms ? -1 : ra->start_ms > rb->start_ms;
+}
+
+/* Reads labels in audacity's label track format: "<start> <end> [name]" in
+ * seconds, one region per line
+ */
+static bool load_labels(struct tune_file *file, const char *path)
+{
+    FILE *f = os_fopen(path, "r");
+    char line[512];
+
+    if (!f) {
+        fprintf(stderr, "Failed to open labels '%s'\n", path);
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        double start, end;
+        for (char *c = line; *c; c++) {
+            if (*c == ',')
+                *c = ' ';
+        }
+        if (line[0] == '#' || sscanf(line, "%lf %lf", &start, &end) != 2 || end < start)
+            continue;
+
+        struct region r = {(uint64_t)(start * 1000.0), (uint64_t)(end * 1000.0)};
+        da_push_back(file->regions, &r);
+    }
+    fclose(f);
+
+    qsort(file->regions.array, file->regions.num, sizeof(struct region), compare_regions);
+    return true;
+}
+
+static void decode_file(void *param)
+{
+    struct tune_job *job = param;
+    struct tune_file *file = job->file;
+    struct tool_stream stream;
+    size_t capacity = 0;
+    size_t read;
+
+    if (!tool_stream_open(&stream, file->path, job->ctx->sample_rate))
+        return;
+
+    file->sample_rate = stream.sample_rate;
+    while ((read = tool_stream_read(&stream)) > 0) {
+        if (file->frames + read > capacity) {
+            capacity = capacity ? capacity * 2 : (size_t)stream.sample_rate * 60;
+            file->peaks = brealloc(file->peaks, sizeof(float) * capacity);
+        }
+        detector_reduce_peaks(file->peaks + file->frames, stream.planes, stream.channels, read);
+        file->frames += read;
+    }
+
+    tool_stream_close(&stream);
+    file->ok = true;
+}
+
+static void evaluate_file(const struct tune_ctx *ctx, const struct detector_settings *s, const struct tune_file *file,
+                          struct tune_result *result)
+{
+    struct detector detector = {0};
+    size_t region = 0;
+    size_t last_hit = (size_t)-1;
+    uint64_t frames = 0;
+
+    memset(result, 0, sizeof(*result));
+    result->regions = (uint32_t)file->regions.num;
+    detector_update(&detector, s, (float)file->sample_rate);
+
+    for (size_t pos = 0; pos < file->frames; pos += TOOL_BLOCK_FRAMES) {
+        size_t count = file->frames - pos < TOOL_BLOCK_FRAMES ? file->frames - pos : TOOL_BLOCK_FRAMES;
+        detector_process_peaks(&detector, file->peaks + pos, count);
+        frames += count;
+
+        uint64_t time = frames * 1000 / file->sample_rate;
+        if (!detector_check_trigger(&detector, time, ctx->clip_length_ms))
+            continue;
+
+        result->triggers++;
+        while (region < file->regions.num && file->regions.array[region].end_ms + ctx->tolerance_ms < time)
+            region++;
+        if (region == file->regions.num || file->regions.array[region].start_ms > time)
+            continue;
+
+        /* Only the first trigger in a region counts towards latency and recall */
+        result->true_positives++;
+        if (region != last_hit) {
+            result->regions_hit++;
+            result->latency_sum_ms += (double)(time - file->regions.array[region].start_ms);
+            last_hit = region;
+        }
+    }
+}
+
+static void evaluate_point(void *param)
+{
+    struct tune_job *job = param;
+    struct tune_point *point = job->point;
+    struct tune_ctx *ctx = job->ctx;
+
+    for (size_t i = 0; i < ctx->file_count; i++) {
+        struct tune_result *r = &point->per_file[i];
+        if (!ctx->files[i].ok)
+            continue;
+
+        evaluate_file(ctx, &point->settings, &ctx->files[i], r);
+        point->total.triggers += r->triggers;
+        point->total.true_positives += r->true_positives;
+        point->total.regions_hit += r->regions_hit;
+        point->total.regions += r->regions;
+        point->total.latency_sum_ms += r->latency_sum_ms;
+    }
+}
+
+static double precision(const struct tune_result *r)
+{
+    return r->triggers ? (double)r->true_positives / (double)r->triggers : 0.0;
+}
+
+static double recall(const struct tune_result *r)
+{
+    return r->regions ? (double)r->regions_hit / (double)r->regions : 0.0;
+}
+
+static double f1(const struct tune_result *r)
+{
+    double p = precision(r), rc = recall(r);
+    return p + rc > 0.0 ? 2.0 * p * rc / (p + rc) : 0.0;
+}
+
+static double latency(const struct tune_result *r)
+{
+    return r->regions_hit ? r->latency_sum_ms / (double)r->regions_hit : 0.0;
+}
+
+static bool better(const struct tune_result *a, const struct tune_result *b)
+{
+    if (f1(a) != f1(b))
+        return f1(a) > f1(b);
+    return latency(a) < latency(b);
+}
+
+/* Accepts a single value, a comma separated list or start:stop:step */
+static bool parse_range(const char *arg, float_list_t *out)
+{
+    float start, stop, step;
+
+    out->num = 0;
+    if (sscanf(arg, "%f:%f:%f", &start, &stop, &step) == 3) {
+        if (step <= 0.0f || stop < start)
+            return false;
+        for (int i = 0; start + (float)i * step <= stop + step * 0.001f; i++) {
+            float v = start + (float)i * step;
+            da_push_back(*out, &v);
+        }
+        return true;
+    }
+
+    const char *c = arg;
+    while (*c) {
+        char *end;
+        float v = strtof(c, &end);
+        if (end == c)
+            return false;
+        da_push_back(*out, &v);
+        c = *end == ',' ? end + 1 : end;
+    }
+    return out->num > 0;
+}
+
+static void print_point(FILE *f, const struct detector_settings *s, const struct tune_result *r)
+{
+    fprintf(f, "%.1f,%.1f,%i,%i,%i,%i,%i,%u,%.4f,%.4f,%.4f,%.1f\n", s->open_threshold_db, s->close_threshold_db,
+            s->attack_time_ms, s->hold_time_ms, s->release_time_ms, s->cooldown_ms, s->lookahead_blocks, r->triggers,
+            precision(r), recall(r), f1(r), latency(r));
+}
+
+static void print_usage(const char *name)
+{
+    printf("Usage: %s [options] <file>...\n"
+           "Searches detector settings against labeled recordings. Labels are read from\n"
+           "'<file>.labels' (audacity label track format, times in seconds) unless given\n"
+           "as '<file>=<labels>'. Prints one CSV row per configuration.\n\n"
+           "Every setting accepts a value, a list (a,b,c) or a range (start:stop:step):\n",
+           name);
+    tool_print_detector_usage();
+    printf("\nOptions:\n"
+           "  -j, --jobs <n>          worker threads (default: logical cores)\n"
+           "  --rate <hz>             resample to this rate before analysis (default %i)\n"
+           "  --clip-length <ms>      notification length added to the cooldown (default 0)\n"
+           "  --tolerance <ms>        triggers this long after a region still count (default 250)\n",
+           TOOL_DEFAULT_SAMPLE_RATE);
+}
+
+int main(int argc, char **argv)
+{
+    struct tune_ctx ctx = {0};
+    DARRAY(struct tune_file) files;
+    DARRAY(struct tune_point) points;
+    float_list_t ranges[TUNE_AXES];
+    const char *range_args[TUNE_AXES] = {"-26", "-32", "25", "200", "150", "1500", "0"};
+    const char *range_names[TUNE_AXES] = {"--open-threshold", "--close-threshold", "--attack",   "--hold",
+                                          "--release",        "--cooldown",        "--lookahead"};
+    size_t threads = 0;
+
+    ctx.sample_rate = TOOL_DEFAULT_SAMPLE_RATE;
+    ctx.tolerance_ms = 250;
+    da_init(files);
+    da_init(points);
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        bool has_value = i + 1 < argc;
+        bool is_range = false;
+
+        for (size_t r = 0; r < TUNE_AXES && has_value; r++) {
+            if (strcmp(arg, range_names[r]) == 0) {
+                range_args[r] = argv[++i];
+                is_range = true;
+                break;
+            }
+        }
+
+        if (is_range) {
+            continue;
+        } else if ((strcmp(arg, "-j") == 0 || strcmp(arg, "--jobs") == 0) && has_value) {
+            threads = (size_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--rate") == 0 && has_value) {
+            ctx.sample_rate = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--clip-length") == 0 && has_value) {
+            ctx.clip_length_ms = (uint64_t)atoll(argv[++i]);
+        } else if (strcmp(arg, "--tolerance") == 0 && has_value) {
+            ctx.tolerance_ms = (uint64_t)atoll(argv[++i]);
+        } else if (arg[0] == '-') {
+            print_usage(argv[0]);
+            return strcmp(arg, "-h") != 0 && strcmp(arg, "--help") != 0;
+        } else {
+            struct tune_file file = {0};
+            file.path = arg;
+            da_push_back(files, &file);
+        }
+    }
+
+    if (!files.num) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    for (size_t r = 0; r < TUNE_AXES; r++) {
+        da_init(ranges[r]);
+        if (!parse_range(range_args[r], &ranges[r])) {
+            fprintf(stderr, "Invalid value '%s' for %s\n", range_args[r], range_names[r]);
+            return 1;
+        }
+    }
+
+    for (size_t i = 0; i < files.num; i++) {
+        struct tune_file *file = &files.array[i];
+        char *sep = strchr(file->path, '=');
+        char labels[512];
+
+        if (sep) {
+            *sep = '\0';
+            snprintf(labels, sizeof(labels), "%s", sep + 1);
+        } else {
+            snprintf(labels, sizeof(labels), "%s.labels", file->path);
+        }
+        if (!load_labels(file, labels))
+            return 1;
+    }
+
+    for (size_t a = 0; a < ranges[0].num; a++)
+        for (size_t b = 0; b < ranges[1].num; b++)
+            for (size_t c = 0; c < ranges[2].num; c++)
+                for (size_t d = 0; d < ranges[3].num; d++)
+                    for (size_t e = 0; e < ranges[4].num; e++)
+                        for (size_t f = 0; f < ranges[5].num; f++)
+                            for (size_t g = 0; g < ranges[6].num; g++) {
+                                struct tune_point point = {0};
+                                point.settings.open_threshold_db = ranges[0].array[a];
+                                point.settings.close_threshold_db = ranges[1].array[b];
+                                point.settings.attack_time_ms = (int)ranges[2].array[c];
+                                point.settings.hold_time_ms = (int)ranges[3].array[d];
+                                point.settings.release_time_ms = (int)ranges[4].array[e];
+                                point.settings.cooldown_ms = (int)ranges[5].array[f];
+                                point.settings.lookahead_blocks = (int)ranges[6].array[g];
+                                if (point.settings.close_threshold_db > point.settings.open_threshold_db)
+                                    continue;
+                                point.per_file = bzalloc(sizeof(struct tune_result) * files.num);
+                                da_push_back(points, &point);
+                            }
+
+    struct task_pool *pool = task_pool_create(threads, "muted-tune");
+    struct tune_job *jobs = bzalloc(sizeof(struct tune_job) * (files.num + points.num));
+    uint64_t start = os_gettime_ns();
+
+    ctx.files = files.array;
+    ctx.file_count = files.num;
+
+    for (size_t i = 0; i < files.num; i++) {
+        jobs[i].ctx = &ctx;
+        jobs[i].file = &files.array[i];
+        task_pool_push(pool, decode_file, &jobs[i]);
+    }
+    task_pool_wait(pool);
+    uint64_t decoded = os_gettime_ns();
+
+    for (size_t i = 0; i < points.num; i++) {
+        jobs[files.num + i].ctx = &ctx;
+        jobs[files.num + i].point = &points.array[i];
+        task_pool_push(pool, evaluate_point, &jobs[files.num + i]);
+    }
+    task_pool_wait(pool);
+    uint64_t end = os_gettime_ns();
+
+    printf("open_threshold,close_threshold,attack,hold,release,cooldown,lookahead,triggers,precision,recall,f1,"
+           "latency_ms\n");
+    for (size_t i = 0; i < points.num; i++)
+        print_point(stdout, &points.array[i].settings, &points.array[i].total);
+
+    for (size_t i = 0; i < files.num; i++) {
+        struct tune_point *best = NULL;
+        if (!files.array[i].ok) {
+            fprintf(stderr, "%s: failed\n", files.array[i].path);
+            continue;
+        }
+        for (size_t p = 0; p < points.num; p++) {
+            if (!best || better(&points.array[p].per_file[i], &best->per_file[i]))
+                best = &points.array[p];
+        }
+        if (best) {
+            fprintf(stderr, "best for %s: ", files.array[i].path);
+            print_point(stderr, &best->settings, &best->per_file[i]);
+        }
+    }
+
+    struct tune_point *best = NULL;
+    for (size_t p = 0; p < points.num; p++) {
+        if (!best || better(&points.array[p].total, &best->total))
+            best = &points.array[p];
+    }
+    if (best) {
+        fprintf(stderr, "best overall: ");
+        print_point(stderr, &best->settings, &best->total);
+    }
+    fprintf(stderr, "%i configurations on %i files, decode %.3f s, search %.3f s on %i threads\n", (int)points.num,
+            (int)files.num, (double)(decoded - start) / 1e9, (double)(end - decoded) / 1e9,
+            (int)task_pool_thread_count(pool));
+
+    task_pool_destroy(pool);
+    for (size_t i = 0; i < points.num; i++)
+        bfree(points.array[i].per_file);
+    for (size_t i = 0; i < files.num; i++) {
+        bfree(files.array[i].peaks);
+        da_free(files.array[i].regions);
+    }
+    for (size_t r = 0; r < TUNE_AXES; r++)
+        da_free(ranges[r]);
+    bfree(jobs);
+    da_free(points);
+    da_free(files);
+    return 0;
+}
@@ -0,0 +1,226 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#include <tlhelp32.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <pthread.h>
+#else
+#include <time.h>
+#endif
+
+#include "tool-common.h"
+
+bool tool_stream_open(struct tool_stream *s, const char *path, uint32_t sample_rate)
+{
+    ma_decoder_config cfg = ma_decoder_config_init(ma_format_f32, 0, sample_rate);
+
+    memset(s, 0, sizeof(*s));
+    if (ma_decoder_init_file(path, &cfg, &s->decoder) != MA_SUCCESS) {
+        fprintf(stderr, "Failed to open '%s'\n", path);
+        return false;
+    }
+
+    s->channels = s->decoder.outputChannels;
+    s->sample_rate = s->decoder.outputSampleRate;
+    if (s->channels == 0 || s->channels > TOOL_MAX_CHANNELS) {
+        fprintf(stderr, "'%s' has %i channels, at most %i are supported\n", path, (int)s->channels,
+                TOOL_MAX_CHANNELS);
+        ma_decoder_uninit(&s->decoder);
+        return false;
+    }
+
+    s->interleaved = bmalloc(sizeof(float) * TOOL_BLOCK_FRAMES * s->channels);
+    for (size_t i = 0; i < s->channels; i++)
+        s->planes[i] = bmalloc(sizeof(float) * TOOL_BLOCK_FRAMES);
+    return true;
+}
+
+void tool_stream_close(struct tool_stream *s)
+{
+    ma_decoder_uninit(&s->decoder);
+    for (size_t i = 0; i < s->channels; i++)
+        bfree(s->planes[i]);
+    bfree(s->interleaved);
+    memset(s, 0, sizeof(*s));
+}
+
+size_t tool_stream_read(struct tool_stream *s)
+{
+    ma_uint64 read = 0;
+    ma_result res = ma_decoder_read_pcm_frames(&s->decoder, s->interleaved, TOOL_BLOCK_FRAMES, &read);
+    if (res != MA_SUCCESS && res != MA_AT_END)
+        return 0;
+
+    ma_deinterleave_pcm_frames(ma_format_f32, (ma_uint32)s->channels, read, s->interleaved, (void **)s->planes);
+    return (size_t)read;
+}
+
+void tool_detector_defaults(struct detector_settings *s)
+{
+    s->open_threshold_db = -26.0f;
+    s->close_threshold_db = -32.0f;
+    s->attack_time_ms = 25;
+    s->hold_time_ms = 200;
+    s->release_time_ms = 150;
+    s->cooldown_ms = 1500;
+    s->scan_stride = 0;
+    s->lookahead_blocks = 0;
+}
+
+bool tool_parse_detector_arg(int argc, char **argv, int *i, struct detector_settings *s)
+{
+    const char *arg = argv[*i];
+
+    if (*i + 1 >= argc)
+        return false;
+
+    if (strcmp(arg, "--open-threshold") == 0)
+        s->open_threshold_db = (float)atof(argv[++*i]);
+    else if (strcmp(arg, "--close-threshold") == 0)
+        s->close_threshold_db = (float)atof(argv[++*i]);
+    else if (strcmp(arg, "--attack") == 0)
+        s->attack_time_ms = atoi(argv[++*i]);
+    else if (strcmp(arg, "--hold") == 0)
+        s->hold_time_ms = atoi(argv[++*i]);
+    else if (strcmp(arg, "--release") == 0)
+        s->release_time_ms = atoi(argv[++*i]);
+    else if (strcmp(arg, "--cooldown") == 0)
+        s->cooldown_ms = atoi(argv[++*i]);
+    else if (strcmp(arg, "--stride") == 0)
+        s->scan_stride = atoi(argv[++*i]);
+    else if (strcmp(arg, "--lookahead") == 0)
+        s->lookahead_blocks = atoi(argv[++*i]);
+    else
+        return false;
+    return true;
+}
+
+void tool_print_detector_usage(void)
+{
+    printf("  --open-threshold <dB>   gate open threshold (default -26)\n"
+           "  --close-threshold <dB>  gate close threshold (default -32)\n"
+           "  --attack <ms>           attack time (default 25)\n"
+           "  --hold <ms>             hold time (default 200)\n"
+           "  --release <ms>          release time (default 150)\n"
+           "  --cooldown <ms>         cooldown between notifications (default 1500)\n"
+           "  --stride <n>            probe every n-th frame while quiet (default 0, full scan)\n"
+           "  --lookahead <blocks>    blocks that have to confirm an opening before it triggers\n"
+           "                          (default 0, at most 8)\n");
+}
+
+#if defined(_WIN32)
+void tool_process_stats(int64_t *rss, int *threads)
+{
+    PROCESS_MEMORY_COUNTERS pmc;
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    THREADENTRY32 entry = {sizeof(entry)};
+    DWORD pid = GetCurrentProcessId();
+
+    *rss = GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)) ? (int64_t)pmc.WorkingSetSize : -1;
+    *threads = -1;
+    if (snapshot == INVALID_HANDLE_VALUE)
+        return;
+
+    *threads = 0;
+    if (Thread32First(snapshot, &entry)) {
+        do {
+            if (entry.th32OwnerProcessID == pid)
+                (*threads)++;
+        } while (Thread32Next(snapshot, &entry));
+    }
+    CloseHandle(snapshot);
+}
+
+uint64_t tool_thread_cpu_ns(void)
+{
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+        return os_gettime_ns();
+    ULARGE_INTEGER k = {{kernel.dwLowDateTime, kernel.dwHighDateTime}};
+    ULARGE_INTEGER u = {{user.dwLowDateTime, user.dwHighDateTime}};
+    return (k.QuadPart + u.QuadPart) * 100;
+}
+#elif defined(__APPLE__)
+void tool_process_stats(int64_t *rss, int *threads)
+{
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    thread_act_array_t list;
+    mach_msg_type_number_t list_count;
+
+    *rss = -1;
+    *threads = -1;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS)
+        *rss = (int64_t)info.resident_size;
+    if (task_threads(mach_task_self(), &list, &list_count) == KERN_SUCCESS) {
+        *threads = (int)list_count;
+        for (mach_msg_type_number_t i = 0; i < list_count; i++)
+            mach_port_deallocate(mach_task_self(), list[i]);
+        vm_deallocate(mach_task_self(), (vm_address_t)list, sizeof(thread_t) * list_count);
+    }
+}
+
+uint64_t tool_thread_cpu_ns(void)
+{
+    mach_port_t thread = pthread_mach_thread_np(pthread_self());
+    thread_basic_info_data_t info;
+    mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+    if (thread_info(thread, THREAD_BASIC_INFO, (thread_info_t)&info, &count) != KERN_SUCCESS)
+        return os_gettime_ns();
+    return ((uint64_t)info.user_time.seconds + (uint64_t)info.system_time.seconds) * 1000000000ULL +
+           ((uint64_t)info.user_time.microseconds + (uint64_t)info.system_time.microseconds) * 1000ULL;
+}
+#else
+void tool_process_stats(int64_t *rss, int *threads)
+{
+    FILE *f = fopen("/proc/self/status", "r");
+    char line[256];
+
+    *rss = -1;
+    *threads = -1;
+    if (!f)
+        return;
+
+    while (fgets(line, sizeof(line), f)) {
+        long long value;
+        if (sscanf(line, "VmRSS: %lld kB", &value) == 1)
+            *rss = (int64_t)value * 1024;
+        else if (sscanf(line, "Threads: %lld", &value) == 1)
+            *threads = (int)value;
+    }
+    fclose(f);
+}
+
+uint64_t tool_thread_cpu_ns(void)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return os_gettime_ns();
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+#endif
@@ -0,0 +1,60 @@
+/**
+ ** This file is part of urmuted.
+ ** Copyright 2023 Alex <uni@vrsal.xyz>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <miniaudio.h>
+
+#include "detector.h"
+
+/* Same block size and channel limit obs uses for its audio output */
+#define TOOL_BLOCK_FRAMES 1024
+#define TOOL_MAX_CHANNELS 8
+#define TOOL_DEFAULT_SAMPLE_RATE 48000
+
+/* Decodes a file in obs sized blocks of planar float audio */
+struct tool_stream {
+    ma_decoder decoder;
+    size_t channels;
+    uint32_t sample_rate;
+    float *interleaved;
+    float *planes[TOOL_MAX_CHANNELS];
+};
+
+bool tool_stream_open(struct tool_stream *s, const char *path, uint32_t sample_rate);
+void tool_stream_close(struct tool_stream *s);
+
+/* Returns the number of frames read into s->planes, zero at the end of the file */
+size_t tool_stream_read(struct tool_stream *s);
+
+/* Default filter settings, same values as muted_defaults */
+void tool_detector_defaults(struct detector_settings *s);
+
+/* Parses one of the detector options at argv[*i], advances *i past its value */
+bool tool_parse_detector_arg(int argc, char **argv, int *i, struct detector_settings *s);
+
+void tool_print_detector_usage(void);
+
+/* Resident memory in bytes and thread count of this process, -1 if unknown */
+void tool_process_stats(int64_t *rss, int *threads);
+
+/* Time spent on the cpu by the calling thread */
+uint64_t tool_thread_cpu_ns(void);